@@ -0,0 +1,12 @@
+/*
+ * host stand-in for avr/pgmspace.h, flash tables are plain RAM on the host
+ */
+
+#ifndef BENCH_PGMSPACE_H_
+#define BENCH_PGMSPACE_H_
+
+#define PROGMEM
+#define pgm_read_byte(p)	(*(const uint8_t *)(p))
+#define pgm_read_word(p)	(*(const uint16_t *)(p))
+
+#endif
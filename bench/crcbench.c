@@ -0,0 +1,123 @@
+/*
+ * crcbench.c
+ *
+ * host benchmark of the CRC8/CRC16 variants against the bitwise loops they replaced,
+ * build and run from the repository root:
+ *   cc -O2 -Ibench -I. -o crcbench bench/crcbench.c && ./crcbench
+ * cycles per byte are read from the TSC on x86, elsewhere only ns per byte are printed.
+ * Host numbers only rank the variants, flash reads and 8 bit shifts cost more on the AVR.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_TSC
+#endif
+
+#include "crc8.c"
+#include "crc16.c"
+
+#define BENCH_LENGTH	256		//one flash page
+#define BENCH_ROUNDS	20000
+
+//bitwise reference, what crc8() did before the tables
+static uint8_t crc8_bitwise( uint8_t crc, uint8_t data )
+{
+	uint8_t bit;
+	for (bit=0;bit<8;bit++) {
+		if ((crc ^ data) & 0x01) crc = (crc >> 1) ^ 0x8C;
+		else crc >>= 1;
+		data >>= 1;
+	}
+	return crc;
+}
+
+static uint16_t crc16_bitwise( uint16_t crc, uint8_t data )
+{
+	uint8_t bit;
+	crc ^= ((uint16_t)data) << 8;
+	for (bit=0;bit<8;bit++) {
+		if (crc & 0x8000) crc = (crc << 1) ^ CRC16POLY;
+		else crc <<= 1;
+	}
+	return crc;
+}
+
+static uint8_t buffer[BENCH_LENGTH];
+static volatile uint16_t sink;
+
+#ifdef BENCH_TSC
+#define BENCH_TSC_START	tsc = __rdtsc()
+#define BENCH_TSC_STOP	tsc = __rdtsc()-tsc
+#else
+#define BENCH_TSC_START
+#define BENCH_TSC_STOP
+#endif
+
+static void bench_print(const char *name, double seconds, uint64_t tsc)
+{
+	double bytes = (double)BENCH_LENGTH*BENCH_ROUNDS;
+	if (tsc!=0) {
+		printf("%-14s %8.2f ns/byte %8.2f cycles/byte\n",name,seconds*1e9/bytes,tsc/bytes);
+	} else {
+		printf("%-14s %8.2f ns/byte\n",name,seconds*1e9/bytes);
+	}
+}
+
+#define BENCH(name, type, update) do { \
+	uint32_t round; \
+	uint16_t i; \
+	type crc = 0; \
+	clock_t start; \
+	double seconds; \
+	uint64_t tsc = 0; \
+	start = clock(); \
+	BENCH_TSC_START; \
+	for (round=0;round<BENCH_ROUNDS;round++) { \
+		for (i=0;i<BENCH_LENGTH;i++) crc = update(crc,buffer[i]); \
+		sink = crc; \
+	} \
+	BENCH_TSC_STOP; \
+	seconds = (double)(clock()-start)/CLOCKS_PER_SEC; \
+	bench_print(name,seconds,tsc); \
+} while (0)
+
+int main(void)
+{
+	const uint8_t check[] = "123456789";
+	uint16_t i;
+	uint8_t c8 = 0;
+	uint16_t c16 = 0;
+
+	//all variants have to agree on the standard check values first
+	for (i=0;i<9;i++) {
+		c8 = crc8_update(c8,check[i]);
+		c16 = crc16_update(c16,check[i]);
+	}
+	if (c8!=0xA1 || crc8((uint8_t *)check,9)!=0xA1 || c16!=0x31C3 || crc16(check,9)!=0x31C3) {
+		printf("check value mismatch\n");
+		return 1;
+	}
+	for (i=0;i<BENCH_LENGTH;i++) {
+		buffer[i] = i*7+3;
+	}
+	c8 = c16 = 0;
+	for (i=0;i<BENCH_LENGTH;i++) {
+		c8 = crc8_update(c8,buffer[i]);
+		c16 = crc16_update(c16,buffer[i]);
+		if (crc8_update_nibble(c8,buffer[i])!=crc8_bitwise(c8,buffer[i]) || crc16_update_nibble(c16,buffer[i])!=crc16_bitwise(c16,buffer[i])) {
+			printf("variant mismatch at %u\n",i);
+			return 1;
+		}
+	}
+
+	BENCH("crc8 table",uint8_t,crc8_update);
+	BENCH("crc8 nibble",uint8_t,crc8_update_nibble);
+	BENCH("crc8 bitwise",uint8_t,crc8_bitwise);
+	BENCH("crc16 table",uint16_t,crc16_update);
+	BENCH("crc16 nibble",uint16_t,crc16_update_nibble);
+	BENCH("crc16 bitwise",uint16_t,crc16_bitwise);
+	return 0;
+}
@@ -6,14 +6,21 @@
  */ 
  
 #include <avr/eeprom.h>
+#include <avr/pgmspace.h>
 #include <util/delay.h>
 #include <avr/interrupt.h>
 #include <string.h>
+#include <stddef.h>
 #include <stdlib.h>
 
 #include "global.h"
 #include "homecan.h"
 #include "channelconfig.h"
+#include "crc16.h"
+#include "debuglog.h"
+#ifdef CONFIG_SAMPLER
+#include "sampler.h"
+#endif
 
 #ifdef CONFIG_ELTAKO
 #include "rs485eltako.h"
@@ -50,7 +57,10 @@
 #define EEPROM_CHANNELCONFIG_MARKER	0x01
 #define EEPROM_CHANNELCONFIG_DATA	0x02
 
-#define MARKER_MAGIC	0x55
+#define MARKER_MAGIC_LEGACY	0x55	//baseline layout without CRC, rejected
+#define MARKER_MAGIC_CRC	0x56	//config followed by its CRC16 and layout
+#define EEPROM_CHANNELCONFIG_CRC	(EEPROM_CHANNELCONFIG_DATA+sizeof(channelconfig))
+#define EEPROM_CHANNELCONFIG_LAYOUT	(EEPROM_CHANNELCONFIG_CRC+2)	//CHANNELCONFIG_LAYOUT, then sizeof(channelconfig_t)
 
 #define HEARBEAT_PERIODIC
 
@@ -60,18 +70,108 @@ channelconfig_t channelconfig[CHANNELCONFIG_MAX_CONFIG+1];
 #ifdef CONFIG_SSR
 #define CHANNELCONFIG_SSR_DELAY_MS	50
 #define CHANNELCONFIG_SSR_MAX_REPEAT 3
+#define CHANNELCONFIG_SSR_SETTLE 2			//20ms until feedback is checked after a pulse
+#define CHANNELCONFIG_SSR_MAX_DETACHED 4	//switch off jobs of reconfigured channels, the oldest one is taken over if all are busy
+
+//SSR of a channel that has been reconfigured, still needs to be switched off
+typedef struct
+{
+	uint8_t port[2];
+	uint8_t channel;	//reconfigured channel, for the error frame
+	uint8_t seq;		//start order, to find the oldest job
+	ssrstate_t ssrstate;
+} ssrjob_t;
+static ssrjob_t ssrDetached[CHANNELCONFIG_SSR_MAX_DETACHED];
+static uint8_t ssrDetachedSeq = 0;
+
+#define SSR_STEP_BUSY	0
+#define SSR_STEP_DONE	1
+#define SSR_STEP_FAILED	2
 #endif
 
 #ifdef CONFIG_RAFFSTORE
 #define CHANNELCONFIG_RAFFSTORE_WAIT_DEFAULT 80			//0,8s
-#define CHANNELCONFIG_RAFFSTORE_UPDATE_INTERVALL 200 	//2s
-static uint8_t update_timer = 0;
+#define CHANNELCONFIG_RAFFSTORE_REPORT_SLOTS 20 		//0,2s, each channel checks for a report once per cycle in its own slot
+#define CHANNELCONFIG_RAFFSTORE_REPORT_DELTA 13 		//~5% of travel
+#define CHANNELCONFIG_RAFFSTORE_OVERRUN_MIN 50 		//0,5s, always added when driving to an end stop
+#define CHANNELCONFIG_RAFFSTORE_DRIFT_SHIFT 6 		//a partial move adds 1/64 of its travel time to the drift estimate
+#define CHANNELCONFIG_RAFFSTORE_DRIFT_MAX 2000 		//20s, a full travel
+#define CHANNELCONFIG_RAFFSTORE_CALIB_MARGIN 2 		//a measurement run drives on for 1/2 of the expected travel time
+#define CHANNELCONFIG_RAFFSTORE_CALIB_OVERRUN_MAX 3000 	//30s, longest drive against an end stop while measuring
+#define CHANNELCONFIG_RAFFSTORE_MAX_STARTS_DEFAULT 2
+#define CHANNELCONFIG_RAFFSTORE_STAGGER_DEFAULT 30		//0,3s
+static uint8_t report_slot = 0;
+//motor start scheduler, limits the inrush current if many raffstores start at once
+static uint8_t raffSchedulerChannel = 0;
+static uint8_t raffMaxStarts = CHANNELCONFIG_RAFFSTORE_MAX_STARTS_DEFAULT;
+static uint8_t raffStagger = CHANNELCONFIG_RAFFSTORE_STAGGER_DEFAULT;
+static volatile uint8_t raffInrush = 0;	//motors inside their start window
+
+#define CHANNELCONFIG_RAFFSTORE_MAX 6		//two outputs each, ControlCAN has 12
+
+//motor state of one raffstore, kept out of channelconfig so unused channels don't carry it
+typedef struct
+{
+	raffmode_t motor;		//direction the motor is currently powered in, RAFFSTORE_IDLE if off
+	uint8_t inrush;			//remaining 10ms ticks of the start window, counts against the start budget
+	uint8_t queued;			//1 if waiting for the scheduler to admit a motor start
+	uint8_t reportedPosition;	//last reported position 0-255
+	uint8_t reportedAngle;		//last reported angle 0-255
+	uint16_t moveTicks;		//10ms ticks the motor was powered since the last stop
+	uint16_t overrun;		//10ms ticks to keep driving against the end stop after the model reached it
+	uint16_t drift;			//estimated model error in 10ms ticks, accumulated from partial moves
+	uint8_t moveDone;		//set by ISR when the motor stopped, evaluated in 100ms task
+	uint8_t resync;			//1 if the current move ends at an end stop with overrun
+} raffruntime_t;
+
+static raffruntime_t raffRuntime[CHANNELCONFIG_RAFFSTORE_MAX];
+
+//only one resync or measurement run at a time per node
+static uint8_t raffCalibChannel = 0;
+static raffcalib_t raffCalib = RAFFSTORE_CALIB_NONE;
+static uint8_t raffCalibPosition = 0;	//target to return to after a resync run
+static uint8_t raffCalibAngle = 0;
 #endif
 
 #ifdef CONFIG_ELTAKO
 #define CHANNELCONFIG_DIMMER_STEP 5
 #endif
 
+#ifdef CONFIG_TEMP
+#define CHANNELCONFIG_THERMOSTAT_SETPOINT_DEFAULT	200		//20°C
+#define CHANNELCONFIG_THERMOSTAT_MIN_ON				1		//%, shorter pulses are skipped
+#define CHANNELCONFIG_THERMOSTAT_STALE				3		//sensor intervals without update until the actuator is switched off
+#endif
+
+#ifdef CONFIG_BUZZER
+#define CHANNELCONFIG_BUZZER_NOTES 8
+
+typedef struct
+{
+	uint16_t freq;			//Hz, 0 is a pause
+	uint8_t duration;		//10ms, 0 ends the pattern
+} buzzernote_t;
+
+static const buzzernote_t buzzerPatterns[BUZZER_PATTERN_COUNT][CHANNELCONFIG_BUZZER_NOTES] PROGMEM = {
+	//BUZZER_PATTERN_ERROR
+	{ {500,10}, {0,0} },
+	//BUZZER_PATTERN_ACK
+	{ {2000,5}, {0,0} },
+	//BUZZER_PATTERN_DOORCHIME
+	{ {659,40}, {523,80}, {0,0} },
+	//BUZZER_PATTERN_ALARM
+	{ {880,25}, {0,5}, {660,25}, {0,5}, {0,0} },
+	//BUZZER_PATTERN_CONFIRM
+	{ {1047,8}, {0,4}, {1319,8}, {0,4}, {1568,15}, {0,0} }
+};
+
+//tone sequencer, stepped in the 10ms ISR
+static volatile uint8_t buzzerPattern = BUZZER_PATTERN_NONE;
+static volatile uint8_t buzzerNote = 0;
+static volatile uint8_t buzzerTimer = 0;
+static volatile uint8_t buzzerRepeat = 0;	//0 repeats until stopped
+#endif
+
 
 #ifdef CONFIG_ONEWIRE
 static uint8_t id[OW_ROMCODE_SIZE];
@@ -87,16 +187,60 @@ static volatile uint8_t irsnd=0;
 #define CHANNELCONFIG_KWB_HK_DAY	77
 #define CHANNELCONFIG_KWB_HK_NIGHT	51
 #define CHANNELCONFIG_KWB_HK_AUTO	64
+#define CHANNELCONFIG_KWB_HK_MIN	(CHANNELCONFIG_KWB_HK_OFF+1)	//setpoint mode never switches the circuit off
+#define CHANNELCONFIG_KWB_HK_MAX	256
+#define CHANNELCONFIG_KWB_HK_DEADBAND	2		//0.1K
+#define CHANNELCONFIG_KWB_HK_INTERVALL_DEFAULT	30	//s, the boiler filters its room sensor
+#endif
+
+#ifdef HEARBEAT_PERIODIC
+uint8_t hearbeatCounter = 0;
+uint8_t heartbeatIntervall = HOMECAN_HEARTBEAT_INTERVALL;
+uint8_t heartbeatSkipped = 0;
 #endif
 
 #ifdef CONFIG_HOMECAN_GATEWAY
 static uint8_t busloadChannel = 0;
+#define CHANNELCONFIG_CLOCK_NTP_RETRY		10		//s, until the first answer
+#define CHANNELCONFIG_CLOCK_NTP_INTERVALL	600		//s
+#define CHANNELCONFIG_CLOCK_SYNC_INTERVALL	60		//s, time broadcast on CAN
 #endif
+static uint8_t clockChannel = 0;
+
+//schedule table, stored behind the channel config
+#define EEPROM_SCHEDULE		0xE00
+#define CHANNELCONFIG_SCHEDULE_SLOTS	16
+#define CHANNELCONFIG_SCHEDULE_CATCHUP	60		//s, larger clock jumps are not replayed
+typedef struct
+{
+	uint8_t weekdays;		//bit0 monday .. bit6 sunday, 0 or 0xFF is an unused slot
+	uint16_t minute;		//local time, minutes since midnight
+	uint8_t channel;		//action, executed like a frame to this device
+	uint8_t msgtype;
+	uint8_t value;			//data[0]
+	uint8_t random;			//min, maximum random delay
+	uint8_t valueHigh;		//data[1], 0xFF in slots written by older firmware
+} scheduleentry_t;
+#define CHANNELCONFIG_SCHEDULE_HIGH	0x80	//slot flag of the frame carrying data[1] of the action
+static uint8_t scheduleChannel = 0;
+static uint32_t scheduleLast = 0;		//local time last evaluated
+static uint16_t scheduleDue = 0;		//slots waiting for execution
+static uint16_t scheduleOffset[CHANNELCONFIG_SCHEDULE_SLOTS];	//s, random delay of the current day
 
 static volatile uint8_t timer1s = 0;
 static volatile uint8_t timer100ms = 0;
 static volatile uint8_t counter = 0;
 
+#if defined(CONFIG_ELTAKO) && defined(CONFIG_KWB) && (CONFIG_ELTAKO_UARTS & CONFIG_KWB_UARTS)
+#error "a UART can only run one RS485 protocol"
+#endif
+#ifdef CONFIG_ELTAKO
+static rs485eltako_bus_t eltakoBus[2];	//indexed by UART, see CONFIG_ELTAKO_UARTS
+#endif
+#ifdef CONFIG_KWB
+static rs485kwb_bus_t kwbBus[2];		//indexed by UART, see CONFIG_KWB_UARTS
+#endif
+
 
 uint8_t channelconfig_getChannel(uint8_t port) {
 	uint8_t ch;
@@ -107,9 +251,26 @@ uint8_t channelconfig_getChannel(uint8_t port) {
 }
 
 #ifdef CONFIG_ELTAKO
-void rxHandler(const rs485eltako_t *msg) {	
+//bus behind an RS485 port, NULL if its UART runs no Eltako bus
+static rs485eltako_bus_t *channelconfig_eltakoBus(uint8_t port) {
+	uint8_t uart = channelconfig_getPortUart(port);
+	if (uart>=2 || !((CONFIG_ELTAKO_UARTS>>uart)&0x01)) return NULL;
+	return &eltakoBus[uart];
+}
+
+static void channelconfig_eltakoTransmit(uint8_t port, const rs485eltako_t *msg) {
+	rs485eltako_bus_t *bus = channelconfig_eltakoBus(port);
+	if (bus==NULL) return;
+	while (!rs485eltako_transmitMessage(bus,msg)) {
+		_delay_ms(1);
+	}
+}
+
+void rxHandler(const rs485eltako_bus_t *bus, const rs485eltako_t *msg) {	
 	uint8_t ch;
 	for (ch=0;ch<=CHANNELCONFIG_MAX_CONFIG;ch++) {
+		//only channels on the receiving bus
+		if (channelconfig_getPortUart(channelconfig[ch].port[0])!=bus->uart) continue;
 		if (channelconfig[ch].function==FUNCTION_FTK) {
 			if (msg->id==channelconfig[ch].enoceanstate.id) {
 				if (msg->org==RS485ELTAKO_ORG_1BS) {
@@ -165,17 +326,33 @@ void rxHandler(const rs485eltako_t *msg) {
 #endif
 
 #ifdef CONFIG_KWB
-void rxHandlerKWB(const rs485kwb_t *msg) {
+//bus behind an RS485 port, NULL if its UART runs no KWB bus
+static rs485kwb_bus_t *channelconfig_kwbBus(uint8_t port) {
+	uint8_t uart = channelconfig_getPortUart(port);
+	if (uart>=2 || !((CONFIG_KWB_UARTS>>uart)&0x01)) return NULL;
+	return &kwbBus[uart];
+}
+
+void rxHandlerKWB(const rs485kwb_bus_t *bus, const rs485kwb_t *msg) {
 	uint8_t ch;
 	if (msg->msgtype==RS485KWB_SENSEMSG) {
 		for (ch=0;ch<=CHANNELCONFIG_MAX_CONFIG;ch++) {
-			if (channelconfig[ch].function==FUNCTION_KWB_TEMP) {
+			if (channelconfig[ch].function==FUNCTION_KWB_TEMP && channelconfig_getPortUart(channelconfig[ch].port[0])==bus->uart) {
 				channelconfig[ch].kwbtemp.value = msg->sense.temp[channelconfig[ch].kwbtemp.channel];
+				channelconfig[ch].kwbtemp.valid = 1;
+				channelconfig[ch].kwbtemp.age = 0;
+			}
+#ifdef CONFIG_POTIO
+			//potentiometer channel, feedback from any KWB bus
+			if (channelconfig[ch].function==FUNCTION_KWB_HK && channelconfig[ch].kwbhk.sense<sizeof(msg->sense.temp)/sizeof(msg->sense.temp[0])) {
+				channelconfig[ch].kwbhk.feedback = msg->sense.temp[channelconfig[ch].kwbhk.sense]*10;
+				channelconfig[ch].kwbhk.fresh = 1;
 			}
+#endif
 		}
 	} else if (msg->msgtype==RS485KWB_CTRLMSG) {
 		for (ch=0;ch<=CHANNELCONFIG_MAX_CONFIG;ch++) {
-			if (channelconfig[ch].function==FUNCTION_KWB_INPUT) {
+			if (channelconfig[ch].function==FUNCTION_KWB_INPUT && channelconfig_getPortUart(channelconfig[ch].port[0])==bus->uart) {
 				uint8_t newValue = 0xFF;
 				switch (channelconfig[ch].kwbstate.channel) {
 				case 0:
@@ -245,18 +422,144 @@ void init_timer3_10ms(void) {
 	TIMSK3 |= (1<<OCIE3A);
 }
 
+#ifdef CONFIG_RAFFSTORE
+//runtime entries of all raffstores except channel, as bitmask
+static uint8_t raffstore_usedSlots(uint8_t channel) {
+	uint8_t p,used = 0;
+	for (p=0;p<=CHANNELCONFIG_MAX_CONFIG;p++) {
+		if (p!=channel && channelconfig[p].function==FUNCTION_RAFFSTORE && channelconfig[p].raffstate.slot<CHANNELCONFIG_RAFFSTORE_MAX) {
+			used |= 1<<channelconfig[p].raffstate.slot;
+		}
+	}
+	return used;
+}
+
+//CHANNELCONFIG_RAFFSTORE_MAX if all are used
+static uint8_t raffstore_freeSlot(uint8_t used) {
+	uint8_t slot;
+	for (slot=0;slot<CHANNELCONFIG_RAFFSTORE_MAX;slot++) {
+		if (!((used>>slot)&0x01)) break;
+	}
+	return slot;
+}
+
+//resync or measurement run of ch, RAFFSTORE_CALIB_NONE if another channel owns the run
+static raffcalib_t raffstore_getCalib(uint8_t ch) {
+	return raffCalibChannel==ch?raffCalib:RAFFSTORE_CALIB_NONE;
+}
+
+static void raffstore_setCalib(uint8_t ch, raffcalib_t calib) {
+	if (calib!=RAFFSTORE_CALIB_NONE) {
+		raffCalibChannel = ch;
+		raffCalib = calib;
+	} else if (raffCalibChannel==ch) {
+		raffCalib = RAFFSTORE_CALIB_NONE;
+	}
+}
+
+#endif
+
+//only run at init and store, the small table is enough
+static uint16_t channelconfig_crc(void) {
+	uint16_t crc = 0;
+	uint16_t i;
+	for (i=0;i<sizeof(channelconfig);i++) {
+		crc = crc16_update_nibble(crc,((uint8_t *)channelconfig)[i]);
+	}
+	return crc;
+}
+
 void channelconfig_init(void) {
 	uint8_t p,marker,didmask;
+#ifdef CONFIG_RAFFSTORE
+	uint8_t raffSlots = 0;
+#endif
 	didmask = 0;
 	channelconfig_init_device();
 	marker = eeprom_read_byte((uint8_t *)EEPROM_CHANNELCONFIG_MARKER);
-	if (marker==MARKER_MAGIC) {
-		channelconfig_setStatusLED(0,1);
+	//MARKER_MAGIC_LEGACY blocks have the baseline offsets, they are never read
+	if (marker==MARKER_MAGIC_CRC) {
 		eeprom_read_block(channelconfig,(uint8_t *)EEPROM_CHANNELCONFIG_DATA,sizeof(channelconfig));
+	}
+	if (marker==MARKER_MAGIC_CRC && channelconfig_crc()!=eeprom_read_word((uint16_t *)EEPROM_CHANNELCONFIG_CRC)) {
+		//corrupt, better unconfigured than driving outputs from garbage
+		marker = 0;
+	}
+	if (eeprom_read_byte((uint8_t *)EEPROM_CHANNELCONFIG_LAYOUT)!=CHANNELCONFIG_LAYOUT
+			|| eeprom_read_byte((uint8_t *)EEPROM_CHANNELCONFIG_LAYOUT+1)!=sizeof(channelconfig_t)) {
+		//written by a firmware with other channel offsets, needs a new config
+		marker = 0;
+	}
+	if (marker==MARKER_MAGIC_CRC) {
+		channelconfig_setStatusLED(0,1);
 	} else {
 		channelconfig_setStatusLED(0,0);
 		memset(channelconfig,0,sizeof(channelconfig));
 	}
+#ifdef CONFIG_RAFFSTORE
+	for (p=0;p<=CHANNELCONFIG_MAX_CONFIG;p++) {
+		if (channelconfig[p].function==FUNCTION_RAFFSTORE) {
+			//runtime state starts empty, all motors are off after reset
+			if (channelconfig[p].raffstate.slot>=CHANNELCONFIG_RAFFSTORE_MAX || ((raffSlots>>channelconfig[p].raffstate.slot)&0x01)) {
+				channelconfig[p].raffstate.slot = raffstore_freeSlot(raffSlots);
+				if (channelconfig[p].raffstate.slot>=CHANNELCONFIG_RAFFSTORE_MAX) {
+					//more blinds than runtime entries
+					memset(&channelconfig[p],0,sizeof(channelconfig_t));
+					continue;
+				}
+			}
+			raffSlots |= 1<<channelconfig[p].raffstate.slot;
+			if (channelconfig[p].raffstate.reportDelta==0) {
+				channelconfig[p].raffstate.reportDelta = CHANNELCONFIG_RAFFSTORE_REPORT_DELTA;
+			}
+		} else if (channelconfig[p].function==FUNCTION_RAFFSTORE_SCHEDULER) {
+			raffSchedulerChannel = p;
+			raffMaxStarts = channelconfig[p].raffschedstate.maxStarts;
+			raffStagger = channelconfig[p].raffschedstate.stagger;
+		}
+	}
+#endif
+	for (p=0;p<=CHANNELCONFIG_MAX_CONFIG;p++) {
+		if (channelconfig[p].function==FUNCTION_CLOCK) {
+			clockChannel = p;
+			channelconfig[p].clockstate.timer = 0;
+		} else if (channelconfig[p].function==FUNCTION_SCHEDULER) {
+			scheduleChannel = p;
+		}
+#ifdef CONFIG_TEMP
+		else if (channelconfig[p].function==FUNCTION_THERMOSTAT) {
+			//actuators are off after reset, start a new cycle
+			channelconfig[p].thermostat.on = 0;
+			channelconfig[p].thermostat.stale = 0;
+			channelconfig[p].thermostat.output = 0;
+			channelconfig[p].thermostat.timer = 0;
+		} else if (channelconfig[p].function==FUNCTION_TEMPSENS) {
+			//stored value is from before the reset
+			channelconfig[p].tempstate.valid = 0;
+			channelconfig[p].tempstate.age = 0;
+		}
+#endif
+#ifdef CONFIG_KWB
+		else if (channelconfig[p].function==FUNCTION_KWB_TEMP) {
+			channelconfig[p].kwbtemp.valid = 0;
+			channelconfig[p].kwbtemp.age = 0;
+		}
+#endif
+	}
+#ifdef CONFIG_MOTION
+	for (p=0;p<=CHANNELCONFIG_MAX_CONFIG;p++) {
+		if (channelconfig[p].function==FUNCTION_MOTION) {
+			//occupancy is rebuilt from fresh detections after reset
+			channelconfig[p].motionstate.value = 0;
+			channelconfig[p].motionstate.raw = 0;
+			channelconfig[p].motionstate.holdTimer = 0;
+			channelconfig[p].motionstate.offTimer = 0;
+			channelconfig[p].motionstate.countTimer = 0;
+			channelconfig[p].motionstate.events = 0;
+			channelconfig[p].motionstate.countReport = 0;
+		}
+	}
+#endif
 	for (p=0;p<=channelconfig_getMaxPort();p++) {
 		if (channelconfig_getPortType(p)==CIRCUIT_ANALOG) {
 			didmask |= 1<<p; //disable digital
@@ -265,13 +568,21 @@ void channelconfig_init(void) {
 	DIDR0 = didmask;
 
 #ifdef CONFIG_ELTAKO
-	rs485eltako_init();
-	rs485eltako_setRxHandler(rxHandler);
+	for (p=0;p<2;p++) {
+		if ((CONFIG_ELTAKO_UARTS>>p)&0x01) {
+			rs485eltako_init(&eltakoBus[p],p);
+			rs485eltako_setRxHandler(&eltakoBus[p],rxHandler);
+		}
+	}
 #endif
 
 #ifdef CONFIG_KWB
-	rs485kwb_init();
-	rs485kwb_setRxHandler(rxHandlerKWB);
+	for (p=0;p<2;p++) {
+		if ((CONFIG_KWB_UARTS>>p)&0x01) {
+			rs485kwb_init(&kwbBus[p],p);
+			rs485kwb_setRxHandler(&kwbBus[p],rxHandlerKWB);
+		}
+	}
 #endif
 
 #ifdef CONFIG_IR
@@ -302,10 +613,27 @@ void channelconfig_init(void) {
 #endif
 #ifdef CONFIG_POTIO
 	mcp4651_init();
+	for (p=0;p<=CHANNELCONFIG_MAX_CONFIG;p++) {
+		if (channelconfig[p].function==FUNCTION_KWB_HK) {
+			//restore the stored wiper, older layouts did not keep it
+			channelconfig[p].kwbhk.timer = 0;
+			channelconfig[p].kwbhk.fresh = 0;
+			if (channelconfig[p].kwbhk.position<CHANNELCONFIG_KWB_HK_OFF || channelconfig[p].kwbhk.position>CHANNELCONFIG_KWB_HK_MAX) {
+				channelconfig[p].kwbhk.position = CHANNELCONFIG_KWB_HK_AUTO;
+			}
+			mcp4651_setWiperAsync(channelconfig[p].kwbhk.hk,channelconfig[p].kwbhk.position);
+		}
+	}
 #endif
 #endif
 
 	homecan_init(HOMECAN_ADDRESS_FROM_EEPROM);
+	//random schedule delays differ between nodes
+	srandom(homecan_getDeviceID());
+#ifdef HEARBEAT_PERIODIC
+	//random phase, nodes powered up together do not send at once
+	hearbeatCounter = random()%HOMECAN_HEARTBEAT_INTERVALL;
+#endif
 
 	init_timer3_10ms();
 }
@@ -316,12 +644,191 @@ ISR(ADC_vect) {
 }
 #endif
 
+#ifdef CONFIG_RAFFSTORE
+static uint8_t raffstore_getPosition(uint8_t ch) {
+	return (((uint32_t)channelconfig[ch].raffstate.position)*255)/CHANNELCONFIG_RAFFSTORE_POSITION_MAX;
+}
+
+static uint8_t raffstore_getAngle(uint8_t ch) {
+	return (((uint32_t)channelconfig[ch].raffstate.angle)*255)/CHANNELCONFIG_RAFFSTORE_ANGLE_MAX;
+}
+
+//switch off both relays of a raffstore and give back its start slot
+static void raffstore_stopMotor(uint8_t ch) {
+	channelconfig_setPort(channelconfig[ch].port[0],0);
+	channelconfig_setPort(channelconfig[ch].port[1],0);
+	if (raffRuntime[channelconfig[ch].raffstate.slot].inrush>0) {
+		raffRuntime[channelconfig[ch].raffstate.slot].inrush = 0;
+		raffInrush--;
+	}
+	raffRuntime[channelconfig[ch].raffstate.slot].motor = RAFFSTORE_IDLE;
+}
+
+//returns false if no start slot is free, motor has to stay off and retry next tick
+static bool raffstore_startMotor(uint8_t ch) {
+	if (raffRuntime[channelconfig[ch].raffstate.slot].motor==RAFFSTORE_IDLE && raffStagger!=0) {
+		if (raffInrush>=raffMaxStarts) return false;
+		raffInrush++;
+		raffRuntime[channelconfig[ch].raffstate.slot].inrush = raffStagger;
+	}
+	raffRuntime[channelconfig[ch].raffstate.slot].motor = channelconfig[ch].raffstate.mode;
+	return true;
+}
+#endif
+
+static void transmitState(homecan_t *msg);
+
+#ifdef CONFIG_SSR
+//SSR state machine, called every 10ms: pulse port[0], wait, check feedback on port[1], retry with longer pulse
+static uint8_t ssr_step(ssrstate_t *ssr, uint8_t port0, uint8_t port1) {
+	switch (ssr->phase) {
+	case SSR_PHASE_IDLE:
+		break;
+	case SSR_PHASE_CHECK:
+		if (channelconfig_getPort(port1)==ssr->target) {
+			ssr->phase = SSR_PHASE_IDLE;
+			return SSR_STEP_DONE;
+		}
+		if (ssr->retry>=CHANNELCONFIG_SSR_MAX_REPEAT) {
+			ssr->phase = SSR_PHASE_IDLE;
+			return SSR_STEP_FAILED;
+		}
+		ssr->retry++;
+		channelconfig_setPort(port0, 0x01);
+		ssr->timer = (CHANNELCONFIG_SSR_DELAY_MS/10) * ssr->retry;
+		ssr->phase = SSR_PHASE_PULSE;
+		break;
+	case SSR_PHASE_PULSE:
+		if (--ssr->timer==0) {
+			channelconfig_setPort(port0, 0x00);
+			ssr->timer = CHANNELCONFIG_SSR_SETTLE;
+			ssr->phase = SSR_PHASE_SETTLE;
+		}
+		break;
+	case SSR_PHASE_SETTLE:
+		if (--ssr->timer==0) {
+			ssr->phase = SSR_PHASE_CHECK;
+		}
+		break;
+	}
+	return SSR_STEP_BUSY;
+}
+
+//start switching, called from main context
+static void ssr_switch(ssrstate_t *ssr, uint8_t target) {
+	uint8_t tmp_sreg = SREG;
+	cli();
+	ssr->target = target;
+	ssr->retry = 0;
+	if (ssr->phase==SSR_PHASE_IDLE) {
+		ssr->phase = SSR_PHASE_CHECK;
+	}
+	SREG = tmp_sreg;
+}
+
+//switching off a detached SSR failed or was given up, reported on the channel it came from
+static void ssr_reportDetached(uint8_t channel) {
+	homecan_t msg;
+	msg.header.priority = HOMECAN_HEADER_PRIO_DEFAULT;
+	msg.header.mode = HOMECAN_HEADER_MODE_SRC;
+	msg.msgtype = HOMECAN_MSGTYPE_ERROR;
+	msg.address = homecan_getDeviceID();
+	msg.channel = channel;
+	msg.length = 2;
+	msg.data[0] = HOMECAN_ERROR_SSR_FEEDBACK;
+	msg.data[1] = 0;
+	transmitState(&msg);
+}
+
+//switch off the SSR of a reconfigured channel without blocking: a job for the same port,
+//else a free one, else the oldest one is taken over and its unfinished switch off reported
+static void ssr_detach(uint8_t channel) {
+	uint8_t job;
+	uint8_t free = CHANNELCONFIG_SSR_MAX_DETACHED;
+	uint8_t oldest = 0;
+	uint8_t lost = 0xFF;
+	uint8_t tmp_sreg;
+	for (job=0;job<CHANNELCONFIG_SSR_MAX_DETACHED;job++) {
+		if (ssrDetached[job].port[0]==channelconfig[channel].port[0]) break;
+		if (ssrDetached[job].ssrstate.phase==SSR_PHASE_IDLE) {
+			if (free==CHANNELCONFIG_SSR_MAX_DETACHED) free = job;
+		} else if ((uint8_t)(ssrDetachedSeq-ssrDetached[job].seq)>(uint8_t)(ssrDetachedSeq-ssrDetached[oldest].seq)) {
+			oldest = job;
+		}
+	}
+	if (job==CHANNELCONFIG_SSR_MAX_DETACHED) job = (free!=CHANNELCONFIG_SSR_MAX_DETACHED)?free:oldest;
+	tmp_sreg = SREG;
+	cli();
+	if (ssrDetached[job].ssrstate.phase!=SSR_PHASE_IDLE && ssrDetached[job].port[0]!=channelconfig[channel].port[0]) {
+		channelconfig_setPort(ssrDetached[job].port[0], 0x00);
+		lost = ssrDetached[job].channel;
+	}
+	ssrDetached[job].ssrstate.phase = SSR_PHASE_IDLE;
+	ssrDetached[job].ssrstate.error = 0;
+	ssrDetached[job].port[0] = channelconfig[channel].port[0];
+	ssrDetached[job].port[1] = channelconfig[channel].port[1];
+	ssrDetached[job].channel = channel;
+	ssrDetached[job].seq = ssrDetachedSeq++;
+	SREG = tmp_sreg;
+	ssr_switch(&ssrDetached[job].ssrstate,0);
+	if (lost!=0xFF) ssr_reportDetached(lost);
+}
+#endif
+
+#ifdef CONFIG_BUZZER
+//play the next note of the running pattern, called every 10ms
+static void buzzer_step(void) {
+	uint8_t duration = 0;
+	if (buzzerPattern==BUZZER_PATTERN_NONE) return;
+	if (buzzerTimer>1) {
+		buzzerTimer--;
+		return;
+	}
+	if (buzzerNote<CHANNELCONFIG_BUZZER_NOTES) {
+		duration = pgm_read_byte(&buzzerPatterns[buzzerPattern][buzzerNote].duration);
+	}
+	if (duration==0) {
+		//end of pattern
+		if (buzzerRepeat==1) {
+			channelconfig_setBuzzer(0);
+			buzzerPattern = BUZZER_PATTERN_NONE;
+			return;
+		}
+		if (buzzerRepeat>1) {
+			buzzerRepeat--;
+		}
+		buzzerNote = 0;
+		duration = pgm_read_byte(&buzzerPatterns[buzzerPattern][0].duration);
+	}
+	channelconfig_setBuzzer(pgm_read_word(&buzzerPatterns[buzzerPattern][buzzerNote].freq));
+	buzzerTimer = duration;
+	buzzerNote++;
+}
+
+//start a stored pattern, BUZZER_PATTERN_NONE stops, a running pattern is not restarted
+void channelconfig_playBuzzer(uint8_t pattern, uint8_t repeat) {
+	uint8_t tmp_sreg = SREG;
+	cli();
+	if (pattern>=BUZZER_PATTERN_COUNT) {
+		buzzerPattern = BUZZER_PATTERN_NONE;
+		channelconfig_setBuzzer(0);
+	} else if (pattern!=buzzerPattern) {
+		buzzerPattern = pattern;
+		buzzerNote = 0;
+		buzzerTimer = 0;
+		buzzerRepeat = repeat;
+	}
+	SREG = tmp_sreg;
+}
+#endif
+
 void channelconfig_10msISR(void) {
 	uint8_t ch;
 #ifdef CONFIG_RAFFSTORE
-	update_timer++;
-	if (update_timer>CHANNELCONFIG_RAFFSTORE_UPDATE_INTERVALL) {
-		update_timer = 0;
+	uint8_t queued = 0;
+	report_slot++;
+	if (report_slot>=CHANNELCONFIG_RAFFSTORE_REPORT_SLOTS) {
+		report_slot = 0;
 	}
 #endif
 	for (ch=0;ch<=CHANNELCONFIG_MAX_CONFIG;ch++) {
@@ -333,21 +840,50 @@ void channelconfig_10msISR(void) {
 #endif
 #ifdef CONFIG_RAFFSTORE
 		case FUNCTION_RAFFSTORE:
+			if (raffRuntime[channelconfig[ch].raffstate.slot].inrush>0) {
+				raffRuntime[channelconfig[ch].raffstate.slot].inrush--;
+				if (raffRuntime[channelconfig[ch].raffstate.slot].inrush==0) {
+					raffInrush--;
+				}
+			}
+			raffRuntime[channelconfig[ch].raffstate.slot].queued = 0;
 			if (channelconfig[ch].raffstate.mode!=RAFFSTORE_IDLE) {
-				if (abs((int16_t)channelconfig[ch].raffstate.angle-channelconfig[ch].raffstate.angleTarget)<((uint16_t)channelconfig[ch].raffstate.angleOpen/2) && labs((int32_t)channelconfig[ch].raffstate.position-channelconfig[ch].raffstate.positionTarget)<((uint16_t)channelconfig[ch].raffstate.positionUp/2)) {
+				bool reached = abs((int16_t)channelconfig[ch].raffstate.angle-channelconfig[ch].raffstate.angleTarget)<((uint16_t)channelconfig[ch].raffstate.angleOpen/2) && labs((int32_t)channelconfig[ch].raffstate.position-channelconfig[ch].raffstate.positionTarget)<((uint16_t)channelconfig[ch].raffstate.positionUp/2);
+				if (reached && raffRuntime[channelconfig[ch].raffstate.slot].overrun==0) {
 					//Position & Angle Target reached
 					//stop raffstore
-					channelconfig_setPort(channelconfig[ch].port[0],0);
-					channelconfig_setPort(channelconfig[ch].port[1],0);
+					raffstore_stopMotor(ch);
 					channelconfig[ch].raffstate.mode=RAFFSTORE_IDLE;
+					raffRuntime[channelconfig[ch].raffstate.slot].moveDone = 1;
 					channelconfig[ch].changed = 1;
 				} else {
-					//send update
-					if (update_timer==CHANNELCONFIG_RAFFSTORE_UPDATE_INTERVALL) {
-						channelconfig[ch].changed = 1;
+					//send update if moved far enough, channels are spread over the slots of a report cycle
+					if (report_slot==ch%CHANNELCONFIG_RAFFSTORE_REPORT_SLOTS && !channelconfig[ch].changed) {
+						uint8_t pos = raffstore_getPosition(ch);
+						uint8_t angle = raffstore_getAngle(ch);
+						if (abs((int16_t)pos-raffRuntime[channelconfig[ch].raffstate.slot].reportedPosition)>=channelconfig[ch].raffstate.reportDelta ||
+								abs((int16_t)angle-raffRuntime[channelconfig[ch].raffstate.slot].reportedAngle)>=channelconfig[ch].raffstate.reportDelta) {
+							channelconfig[ch].changed = 1;
+						}
 					}
 
-					if (channelconfig[ch].raffstate.positionTarget>channelconfig[ch].raffstate.position) {
+					if (reached) {
+						//model is at the end stop, keep driving against it so the blind really gets there
+						if (raffRuntime[channelconfig[ch].raffstate.slot].motor!=RAFFSTORE_IDLE) {
+							raffRuntime[channelconfig[ch].raffstate.slot].overrun--;
+						}
+						if (channelconfig[ch].raffstate.positionTarget==0) {
+							if (channelconfig[ch].raffstate.mode==RAFFSTORE_DOWN) {
+								channelconfig[ch].raffstate.wait = CHANNELCONFIG_RAFFSTORE_WAIT_DEFAULT;
+							}
+							channelconfig[ch].raffstate.mode=RAFFSTORE_UP;
+						} else {
+							if (channelconfig[ch].raffstate.mode==RAFFSTORE_UP) {
+								channelconfig[ch].raffstate.wait = CHANNELCONFIG_RAFFSTORE_WAIT_DEFAULT;
+							}
+							channelconfig[ch].raffstate.mode=RAFFSTORE_DOWN;
+						}
+					} else if (channelconfig[ch].raffstate.positionTarget>channelconfig[ch].raffstate.position) {
 						//need to go further down
 						if (channelconfig[ch].raffstate.mode==RAFFSTORE_UP) {
 							channelconfig[ch].raffstate.wait = CHANNELCONFIG_RAFFSTORE_WAIT_DEFAULT;
@@ -376,10 +912,18 @@ void channelconfig_10msISR(void) {
 					}
 
 					if (channelconfig[ch].raffstate.wait==0) {
-						if (channelconfig[ch].raffstate.mode==RAFFSTORE_DOWN) {
+						if ((channelconfig[ch].raffstate.mode==RAFFSTORE_DOWN || channelconfig[ch].raffstate.mode==RAFFSTORE_UP) &&
+								raffRuntime[channelconfig[ch].raffstate.slot].motor!=channelconfig[ch].raffstate.mode && !raffstore_startMotor(ch)) {
+							//no start slot free, keep motor off and wait in queue
+							raffRuntime[channelconfig[ch].raffstate.slot].queued = 1;
+							queued++;
+						} else if (channelconfig[ch].raffstate.mode==RAFFSTORE_DOWN) {
 							//moving downwards
 							channelconfig_setPort(channelconfig[ch].port[0],0);
 							channelconfig_setPort(channelconfig[ch].port[1],1);
+							if (raffRuntime[channelconfig[ch].raffstate.slot].moveTicks<0xFFFF) {
+								raffRuntime[channelconfig[ch].raffstate.slot].moveTicks++;
+							}
 							if (channelconfig[ch].raffstate.angle+channelconfig[ch].raffstate.angleClose<CHANNELCONFIG_RAFFSTORE_ANGLE_MAX) {
 								channelconfig[ch].raffstate.angle += channelconfig[ch].raffstate.angleClose;
 							} else if (channelconfig[ch].raffstate.angle<CHANNELCONFIG_RAFFSTORE_ANGLE_MAX) {
@@ -391,11 +935,13 @@ void channelconfig_10msISR(void) {
 									channelconfig[ch].raffstate.position = CHANNELCONFIG_RAFFSTORE_POSITION_MAX;
 								}
 							}
-						}
-						if (channelconfig[ch].raffstate.mode==RAFFSTORE_UP) {
+						} else if (channelconfig[ch].raffstate.mode==RAFFSTORE_UP) {
 							//moving upwards
 							channelconfig_setPort(channelconfig[ch].port[1],0);
 							channelconfig_setPort(channelconfig[ch].port[0],1);
+							if (raffRuntime[channelconfig[ch].raffstate.slot].moveTicks<0xFFFF) {
+								raffRuntime[channelconfig[ch].raffstate.slot].moveTicks++;
+							}
 							if (channelconfig[ch].raffstate.angle>=channelconfig[ch].raffstate.angleOpen) {
 								channelconfig[ch].raffstate.angle -= channelconfig[ch].raffstate.angleOpen;
 							} else if (channelconfig[ch].raffstate.angle>0) {
@@ -409,22 +955,49 @@ void channelconfig_10msISR(void) {
 							}
 						}
 					} else {
-						channelconfig_setPort(channelconfig[ch].port[0],0);
-						channelconfig_setPort(channelconfig[ch].port[1],0);
+						raffstore_stopMotor(ch);
 						channelconfig[ch].raffstate.wait--;
 					}
 				}
 			}
 		break;
+#endif
+#ifdef CONFIG_SSR
+		case FUNCTION_SSR:
+			if (ssr_step(&channelconfig[ch].ssrstate,channelconfig[ch].port[0],channelconfig[ch].port[1])==SSR_STEP_FAILED) {
+				debuglog(LOG_SSR_FEEDBACK,ch,channelconfig[ch].state);
+				channelconfig[ch].ssrstate.error = 1;
+				channelconfig[ch].changed = 1;
+			}
+		break;
 #endif
 		default:
 		break;
 		}
 	}
+#ifdef CONFIG_SSR
+	for (ch=0;ch<CHANNELCONFIG_SSR_MAX_DETACHED;ch++) {
+		if (ssr_step(&ssrDetached[ch].ssrstate,ssrDetached[ch].port[0],ssrDetached[ch].port[1])==SSR_STEP_FAILED) {
+			ssrDetached[ch].ssrstate.error = 1;
+		}
+	}
+#endif
+#ifdef CONFIG_BUZZER
+	buzzer_step();
+#endif
+#ifdef CONFIG_RAFFSTORE
+	if (raffSchedulerChannel!=0 && channelconfig[raffSchedulerChannel].raffschedstate.queued!=queued) {
+		//report queue state only if it changes
+		channelconfig[raffSchedulerChannel].raffschedstate.queued = queued;
+		channelconfig[raffSchedulerChannel].raffschedstate.inrush = raffInrush;
+		channelconfig[raffSchedulerChannel].changed = 1;
+	}
+#endif
 }
 
 ISR(TIMER3_COMPA_vect) {
 	//10ms interrupt
+	homecan_tick();
 	channelconfig_10msISR();
 	channelconfig_10msUserISR();
 	counter++;
@@ -440,7 +1013,10 @@ ISR(TIMER3_COMPA_vect) {
 
 void channelconfig_storeConfig(void) {
 	eeprom_update_block(channelconfig,(uint8_t *)EEPROM_CHANNELCONFIG_DATA,sizeof(channelconfig));
-	eeprom_update_byte((uint8_t *)EEPROM_CHANNELCONFIG_MARKER,MARKER_MAGIC);
+	eeprom_update_word((uint16_t *)EEPROM_CHANNELCONFIG_CRC,channelconfig_crc());
+	eeprom_update_byte((uint8_t *)EEPROM_CHANNELCONFIG_LAYOUT,CHANNELCONFIG_LAYOUT);
+	eeprom_update_byte((uint8_t *)EEPROM_CHANNELCONFIG_LAYOUT+1,sizeof(channelconfig_t));
+	eeprom_update_byte((uint8_t *)EEPROM_CHANNELCONFIG_MARKER,MARKER_MAGIC_CRC);
 }
 
 void channelconfig_clearConfig(void) {
@@ -499,6 +1075,15 @@ void transmitChannelConfig(uint8_t channel) {
 		msg.data[2] = channelconfig[channel].port[1];
 		msg.data[3] = channelconfig[channel].tempstate.intervall;
 		break;
+	case FUNCTION_THERMOSTAT:
+		msg.length = 7;
+		msg.data[1] = channelconfig[channel].port[0];
+		msg.data[2] = channelconfig[channel].thermostat.sensor;
+		msg.data[3] = channelconfig[channel].thermostat.actuator;
+		msg.data[4] = channelconfig[channel].thermostat.mode;
+		msg.data[5] = channelconfig[channel].thermostat.hysteresis;
+		msg.data[6] = channelconfig[channel].thermostat.period;
+		break;
 #endif
 #ifdef CONFIG_LED
 	case FUNCTION_LED:
@@ -521,8 +1106,12 @@ void transmitChannelConfig(uint8_t channel) {
 #endif
 #ifdef CONFIG_MOTION
 	case FUNCTION_MOTION:
-		msg.length = 2;
+		msg.length = 6;
 		msg.data[1] = channelconfig[channel].port[0];
+		msg.data[2] = channelconfig[channel].motionstate.hold&0xFF;
+		msg.data[3] = channelconfig[channel].motionstate.hold>>8;
+		msg.data[4] = channelconfig[channel].motionstate.minOff;
+		msg.data[5] = channelconfig[channel].motionstate.countIntervall;
 		break;
 #endif
 #ifdef CONFIG_ANALOG
@@ -540,13 +1129,20 @@ void transmitChannelConfig(uint8_t channel) {
 #endif
 #ifdef CONFIG_RAFFSTORE
 	case FUNCTION_RAFFSTORE:
-		msg.length = 7;
+		msg.length = 8;
 		msg.data[1] = channelconfig[channel].port[0];
 		msg.data[2] = channelconfig[channel].port[1];
 		msg.data[3] = channelconfig[channel].raffstate.positionUp;
 		msg.data[4] = channelconfig[channel].raffstate.positionDown;
 		msg.data[5] = channelconfig[channel].raffstate.angleOpen;
 		msg.data[6] = channelconfig[channel].raffstate.angleClose;
+		msg.data[7] = channelconfig[channel].raffstate.reportDelta;
+		break;
+	case FUNCTION_RAFFSTORE_SCHEDULER:
+		msg.length = 4;
+		msg.data[1] = channelconfig[channel].port[0];
+		msg.data[2] = channelconfig[channel].raffschedstate.maxStarts;
+		msg.data[3] = channelconfig[channel].raffschedstate.stagger;
 		break;
 #endif
 #ifdef CONFIG_SSR
@@ -572,10 +1168,12 @@ void transmitChannelConfig(uint8_t channel) {
 		msg.data[4] = channelconfig[channel].kwbtemp.intervall;
 		break;
 	case FUNCTION_KWB_HK:
-		msg.length = 4;
+		msg.length = 6;
 		msg.data[1] = channelconfig[channel].port[0];
 		msg.data[2] = channelconfig[channel].port[1];
 		msg.data[3] = channelconfig[channel].kwbhk.mode;
+		msg.data[4] = channelconfig[channel].kwbhk.sense;
+		msg.data[5] = channelconfig[channel].kwbhk.intervall;
 		break;
 #endif
 #ifdef CONFIG_HOMECAN_GATEWAY
@@ -586,6 +1184,17 @@ void transmitChannelConfig(uint8_t channel) {
 		msg.data[3] = channelconfig[channel].busloadstate.intervall;
 		break;
 #endif
+	case FUNCTION_SCHEDULER:
+		msg.length = 3;
+		msg.data[1] = channelconfig[channel].port[0];
+		msg.data[2] = channelconfig[channel].schedulestate.utcOffset;
+		break;
+	case FUNCTION_CLOCK:
+		msg.length = 7;
+		msg.data[1] = channelconfig[channel].port[0];
+		msg.data[2] = channelconfig[channel].clockstate.flags;
+		memcpy(&msg.data[3],channelconfig[channel].clockstate.ntpip,4);
+		break;
 	}
 	while (!homecan_transmit(&msg)) {
 		_delay_ms(1);
@@ -593,6 +1202,9 @@ void transmitChannelConfig(uint8_t channel) {
 }
 
 bool channelconfig_configure(uint8_t channel, const channelconfig_t *config) {
+#ifdef CONFIG_RAFFSTORE
+	uint8_t raffSlot = 0;
+#endif
 	if (channel > CHANNELCONFIG_MAX_CONFIG)
 		return false;
 	//TODO reset old function state to init state
@@ -603,19 +1215,31 @@ bool channelconfig_configure(uint8_t channel, const channelconfig_t *config) {
 		break;
 #endif
 #ifdef CONFIG_RAFFSTORE
-	case FUNCTION_RAFFSTORE:
-		channelconfig_setPort(channelconfig[channel].port[0], 0);
-		channelconfig_setPort(channelconfig[channel].port[1], 0);
+	case FUNCTION_RAFFSTORE: {
+		uint8_t tmp_sreg = SREG;
+		cli();
+		raffstore_stopMotor(channel);
+		channelconfig[channel].raffstate.mode = RAFFSTORE_IDLE;
+		SREG = tmp_sreg;
+		raffstore_setCalib(channel,RAFFSTORE_CALIB_NONE);
+	}
+		break;
+	case FUNCTION_RAFFSTORE_SCHEDULER:
+		raffSchedulerChannel = 0;
+		raffMaxStarts = CHANNELCONFIG_RAFFSTORE_MAX_STARTS_DEFAULT;
+		raffStagger = CHANNELCONFIG_RAFFSTORE_STAGGER_DEFAULT;
 		break;
 #endif
 #ifdef CONFIG_SSR
 	case FUNCTION_SSR: {
-		uint8_t loop = 1;
-		while (channelconfig_getPort(channelconfig[channel].port[1]) && loop <= CHANNELCONFIG_SSR_MAX_REPEAT) {
-			channelconfig_setPort(channelconfig[channel].port[0], 0x01);
-			_delay_ms(CHANNELCONFIG_SSR_DELAY_MS * loop);
-			channelconfig_setPort(channelconfig[channel].port[0], 0x00);
-			loop++;
+		//hand over to a detached job, switching off continues in 10ms ISR
+		uint8_t tmp_sreg = SREG;
+		cli();
+		channelconfig[channel].ssrstate.phase = SSR_PHASE_IDLE;
+		channelconfig_setPort(channelconfig[channel].port[0], 0x00);
+		SREG = tmp_sreg;
+		if (channelconfig_getPort(channelconfig[channel].port[1])) {
+			ssr_detach(channel);
 		}
 	}
 		break;
@@ -627,7 +1251,7 @@ bool channelconfig_configure(uint8_t channel, const channelconfig_t *config) {
 #endif
 #ifdef CONFIG_BUZZER
 	case FUNCTION_BUZZER:
-		//TODO turn off buzzer
+		channelconfig_playBuzzer(BUZZER_PATTERN_NONE,0);
 		break;
 #endif
 #ifdef CONFIG_LED
@@ -635,6 +1259,13 @@ bool channelconfig_configure(uint8_t channel, const channelconfig_t *config) {
 		channelconfig_setPort(channelconfig[channel].port[0], 0);
 		break;
 #endif
+	case FUNCTION_CLOCK:
+		clockChannel = 0;
+		break;
+	case FUNCTION_SCHEDULER:
+		scheduleChannel = 0;
+		scheduleDue = 0;
+		break;
 	default:
 		break;
 	}
@@ -644,7 +1275,7 @@ bool channelconfig_configure(uint8_t channel, const channelconfig_t *config) {
 	switch(config->function) {
 #ifdef CONFIG_ELTAKO
 	case FUNCTION_DIMMER:
-		if (channelconfig_getPortType(config->port[0])==CIRCUIT_RS485TX) {
+		if (channelconfig_getPortType(config->port[0])==CIRCUIT_RS485TX && channelconfig_eltakoBus(config->port[0])!=NULL) {
 			//valid
 		} else {
 			return false;
@@ -653,7 +1284,7 @@ bool channelconfig_configure(uint8_t channel, const channelconfig_t *config) {
 	case FUNCTION_FTK:
 	case FUNCTION_FRW:
 	case FUNCTION_ENOCEAN_SNIFFER:
-		if (channelconfig_getPortType(config->port[0])==CIRCUIT_RS485RX) {
+		if (channelconfig_getPortType(config->port[0])==CIRCUIT_RS485RX && channelconfig_eltakoBus(config->port[0])!=NULL) {
 			//valid
 		} else {
 			return false;
@@ -680,12 +1311,22 @@ bool channelconfig_configure(uint8_t channel, const channelconfig_t *config) {
 #endif
 #ifdef CONFIG_RAFFSTORE
 	case FUNCTION_RAFFSTORE:
-		if (channelconfig_getPortType(config->port[0])==CIRCUIT_OUT && channelconfig_getPortType(config->port[1])==CIRCUIT_OUT) {
+		raffSlot = raffstore_freeSlot(raffstore_usedSlots(channel));
+		if (channelconfig_getPortType(config->port[0])==CIRCUIT_OUT && channelconfig_getPortType(config->port[1])==CIRCUIT_OUT && raffSlot<CHANNELCONFIG_RAFFSTORE_MAX) {
 			//valid
 		} else {
 			return false;
 		}
 		break;
+	case FUNCTION_RAFFSTORE_SCHEDULER:
+		if (channelconfig_getPortType(config->port[0])==CIRCUIT_NONE && config->raffschedstate.maxStarts>0) {
+			raffSchedulerChannel = channel;
+			raffMaxStarts = config->raffschedstate.maxStarts;
+			raffStagger = config->raffschedstate.stagger;
+		} else {
+			return false;
+		}
+		break;
 #endif
 #ifdef CONFIG_SSR
 	case FUNCTION_SSR:
@@ -704,6 +1345,47 @@ bool channelconfig_configure(uint8_t channel, const channelconfig_t *config) {
 			return false;
 		}
 		break;
+	case FUNCTION_THERMOSTAT:
+		//sensor and actuator have to be configured first
+		if (config->thermostat.sensor>CHANNELCONFIG_MAX_CONFIG || config->thermostat.actuator>CHANNELCONFIG_MAX_CONFIG) {
+			return false;
+		}
+		switch (channelconfig[config->thermostat.sensor].function) {
+		case FUNCTION_TEMPSENS:
+#ifdef CONFIG_KWB
+		case FUNCTION_KWB_TEMP:
+#endif
+			break;
+		default:
+			return false;
+		}
+		switch (channelconfig[config->thermostat.actuator].function) {
+#ifdef CONFIG_OUTPUT
+		case FUNCTION_OUTPUT:
+#endif
+#ifdef CONFIG_SSR
+		case FUNCTION_SSR:
+#endif
+#ifdef CONFIG_POTIO
+		case FUNCTION_KWB_HK:
+#endif
+			break;
+		default:
+			return false;
+		}
+		if (channelconfig_getPortType(config->port[0])==CIRCUIT_NONE && config->thermostat.period>0 && config->thermostat.mode<=THERMOSTAT_PID) {
+			//valid
+		} else {
+			return false;
+		}
+#ifdef CONFIG_POTIO
+		if (channelconfig[config->thermostat.actuator].function==FUNCTION_KWB_HK) {
+			//the setpoint loop would fight with the thermostat
+			channelconfig[config->thermostat.actuator].kwbhk.mode = KWB_HK_MODE_THERMOSTAT;
+			channelconfig[config->thermostat.actuator].changed = 1;
+		}
+#endif
+		break;
 #endif
 #ifdef CONFIG_LED
 	case FUNCTION_LED:
@@ -745,54 +1427,540 @@ bool channelconfig_configure(uint8_t channel, const channelconfig_t *config) {
 #ifdef CONFIG_KWB
 	case FUNCTION_KWB_INPUT:
 	case FUNCTION_KWB_TEMP:
-		if (channelconfig_getPortType(config->port[0])==CIRCUIT_RS485RX) {
+		if (channelconfig_getPortType(config->port[0])==CIRCUIT_RS485RX && channelconfig_kwbBus(config->port[0])!=NULL) {
 			//valid
 		} else {
 			return false;
 		}
-		break;
-#endif
-#ifdef CONFIG_POTIO
-	case FUNCTION_KWB_HK:
-		if (channelconfig_getPortType(config->port[0])==CIRCUIT_I2C) {
-			//valid
-		} else {
-			return false;
+		break;
+#endif
+#ifdef CONFIG_POTIO
+	case FUNCTION_KWB_HK:
+		if (channelconfig_getPortType(config->port[0])==CIRCUIT_I2C) {
+			//valid
+		} else {
+			return false;
+		}
+		break;
+#endif
+#ifdef CONFIG_HOMECAN_GATEWAY
+	case FUNCTION_BUSLOAD:
+		if (channelconfig_getPortType(config->port[0])==CIRCUIT_NONE) {
+			busloadChannel = channel;
+		} else {
+			return false;
+		}
+		break;
+#endif
+	case FUNCTION_CLOCK:
+		if (channelconfig_getPortType(config->port[0])==CIRCUIT_NONE) {
+			clockChannel = channel;
+		} else {
+			return false;
+		}
+		break;
+	case FUNCTION_SCHEDULER:
+		if (channelconfig_getPortType(config->port[0])==CIRCUIT_NONE) {
+			scheduleChannel = channel;
+			scheduleLast = 0;
+		} else {
+			return false;
+		}
+		break;
+	case FUNCTION_NONE:
+		break;
+	default:
+		return false;
+		break;
+	}
+#ifdef CONFIG_RAFFSTORE
+	if (config->function==FUNCTION_RAFFSTORE) {
+		//ISR must not see the channel before its runtime entry is clean
+		uint8_t tmp_sreg = SREG;
+		cli();
+		memcpy(&channelconfig[channel],config,sizeof(channelconfig_t));
+		channelconfig[channel].raffstate.slot = raffSlot;
+		memset(&raffRuntime[raffSlot],0,sizeof(raffruntime_t));
+		SREG = tmp_sreg;
+		return true;
+	}
+#endif
+	memcpy(&channelconfig[channel],config,sizeof(channelconfig_t));
+	return true;
+}
+
+#ifdef CONFIG_RAFFSTORE
+//set a new target, overrun is the time to drive on after the model reached it
+static void raffstore_setTarget(uint8_t ch, uint32_t position, uint16_t angle, uint16_t overrun) {
+	uint8_t tmp_sreg = SREG;
+	cli();
+	channelconfig[ch].raffstate.positionTarget = position;
+	channelconfig[ch].raffstate.angleTarget = angle;
+	raffRuntime[channelconfig[ch].raffstate.slot].overrun = overrun;
+	raffRuntime[channelconfig[ch].raffstate.slot].resync = overrun!=0;
+	if (channelconfig[ch].raffstate.mode==RAFFSTORE_IDLE) {
+		channelconfig[ch].raffstate.mode = RAFFSTORE_MOVE;
+	}
+	SREG = tmp_sreg;
+}
+
+//normal move, a move to an end stop drives on for the estimated drift to resync the model
+static void raffstore_moveTo(uint8_t ch, uint32_t position, uint16_t angle) {
+	uint16_t overrun = 0;
+	if ((position==0 && angle==0) || (position==CHANNELCONFIG_RAFFSTORE_POSITION_MAX && angle==CHANNELCONFIG_RAFFSTORE_ANGLE_MAX)) {
+		overrun = CHANNELCONFIG_RAFFSTORE_OVERRUN_MIN+raffRuntime[channelconfig[ch].raffstate.slot].drift;
+	}
+	raffstore_setCalib(ch,RAFFSTORE_CALIB_NONE);
+	raffstore_setTarget(ch,position,angle,overrun);
+}
+
+//time to drive on after the model reached the end stop while measuring, relative to the expected travel
+static uint16_t raffstore_calibOverrun(uint8_t ch, bool down) {
+	uint8_t delta = down?channelconfig[ch].raffstate.positionDown:channelconfig[ch].raffstate.positionUp;
+	uint32_t ticks = CHANNELCONFIG_RAFFSTORE_CALIB_OVERRUN_MAX;
+	if (delta!=0) {
+		ticks = (CHANNELCONFIG_RAFFSTORE_POSITION_MAX/delta)/CHANNELCONFIG_RAFFSTORE_CALIB_MARGIN+CHANNELCONFIG_RAFFSTORE_OVERRUN_MIN;
+	}
+	return ticks>CHANNELCONFIG_RAFFSTORE_CALIB_OVERRUN_MAX?CHANNELCONFIG_RAFFSTORE_CALIB_OVERRUN_MAX:ticks;
+}
+
+//patch the measured travel times into the stored config, the rest of it stays untouched.
+//Skipped if the stored block is invalid or holds another function there, STORE_CONFIG keeps them then
+static void raffstore_storeTravelTimes(uint8_t ch) {
+	uint16_t up = (uint16_t)ch*sizeof(channelconfig_t)+offsetof(channelconfig_t,raffstate.positionUp);
+	uint16_t down = (uint16_t)ch*sizeof(channelconfig_t)+offsetof(channelconfig_t,raffstate.positionDown);
+	uint16_t function = (uint16_t)ch*sizeof(channelconfig_t)+offsetof(channelconfig_t,function);
+	uint16_t crc = 0;
+	uint16_t patched = 0;
+	uint16_t i;
+	uint8_t value;
+	if (eeprom_read_byte((uint8_t *)EEPROM_CHANNELCONFIG_MARKER)!=MARKER_MAGIC_CRC) return;
+	if (eeprom_read_byte((uint8_t *)EEPROM_CHANNELCONFIG_DATA+function)!=FUNCTION_RAFFSTORE) return;
+	//one pass for the CRC of the stored block and of the patched one
+	for (i=0;i<sizeof(channelconfig);i++) {
+		value = eeprom_read_byte((uint8_t *)EEPROM_CHANNELCONFIG_DATA+i);
+		crc = crc16_update_nibble(crc,value);
+		if (i==up) value = channelconfig[ch].raffstate.positionUp;
+		if (i==down) value = channelconfig[ch].raffstate.positionDown;
+		patched = crc16_update_nibble(patched,value);
+	}
+	if (crc!=eeprom_read_word((uint16_t *)EEPROM_CHANNELCONFIG_CRC)) return;
+	eeprom_update_byte((uint8_t *)EEPROM_CHANNELCONFIG_DATA+up,channelconfig[ch].raffstate.positionUp);
+	eeprom_update_byte((uint8_t *)EEPROM_CHANNELCONFIG_DATA+down,channelconfig[ch].raffstate.positionDown);
+	eeprom_update_word((uint16_t *)EEPROM_CHANNELCONFIG_CRC,patched);
+}
+
+//measurement finished, keep the travel times over a reset and publish them
+static void raffstore_calibDone(uint8_t ch) {
+	raffstore_storeTravelTimes(ch);
+	transmitChannelConfig(ch);
+}
+
+//called from 100ms task after the ISR stopped the motor
+static void raffstore_moveDone(uint8_t ch) {
+	uint16_t ticks;
+	uint8_t tmp_sreg = SREG;
+	cli();
+	ticks = raffRuntime[channelconfig[ch].raffstate.slot].moveTicks;
+	raffRuntime[channelconfig[ch].raffstate.slot].moveTicks = 0;
+	SREG = tmp_sreg;
+
+	if (raffRuntime[channelconfig[ch].raffstate.slot].resync && (channelconfig[ch].raffstate.position==0 || channelconfig[ch].raffstate.position==CHANNELCONFIG_RAFFSTORE_POSITION_MAX)) {
+		//blind was driven against the end stop, model is exact again
+		raffRuntime[channelconfig[ch].raffstate.slot].drift = 0;
+	} else {
+		uint16_t drift = raffRuntime[channelconfig[ch].raffstate.slot].drift+(ticks>>CHANNELCONFIG_RAFFSTORE_DRIFT_SHIFT);
+		raffRuntime[channelconfig[ch].raffstate.slot].drift = drift>CHANNELCONFIG_RAFFSTORE_DRIFT_MAX?CHANNELCONFIG_RAFFSTORE_DRIFT_MAX:drift;
+	}
+	raffRuntime[channelconfig[ch].raffstate.slot].resync = 0;
+
+	switch (raffstore_getCalib(ch)) {
+	case RAFFSTORE_CALIB_RESYNC:
+		raffstore_moveTo(ch,(((uint32_t)raffCalibPosition)*CHANNELCONFIG_RAFFSTORE_POSITION_MAX)/255,(((uint32_t)raffCalibAngle)*CHANNELCONFIG_RAFFSTORE_ANGLE_MAX)/255);
+		break;
+	case RAFFSTORE_CALIB_MEASURE_TOP:
+		//at the top now, drive down until STOPMOVE marks the lower end stop
+		raffstore_setTarget(ch,CHANNELCONFIG_RAFFSTORE_POSITION_MAX,CHANNELCONFIG_RAFFSTORE_ANGLE_MAX,raffstore_calibOverrun(ch,true));
+		raffstore_setCalib(ch,RAFFSTORE_CALIB_MEASURE_DOWN);
+		break;
+	case RAFFSTORE_CALIB_MEASURE_DOWN:
+		//no mark within the expected travel, the motor end switch has stopped the blind, keep the old delta
+		raffstore_setTarget(ch,0,0,raffstore_calibOverrun(ch,false));
+		raffstore_setCalib(ch,RAFFSTORE_CALIB_MEASURE_UP);
+		break;
+	case RAFFSTORE_CALIB_MEASURE_UP:
+		raffstore_setCalib(ch,RAFFSTORE_CALIB_NONE);
+		raffstore_calibDone(ch);
+		break;
+	case RAFFSTORE_CALIB_NONE:
+		break;
+	}
+}
+
+//STOPMOVE during measurement, end stop reached: derive the position delta from the travel time
+static void raffstore_calibMark(uint8_t ch) {
+	uint16_t ticks,angleTicks;
+	uint8_t angleDelta;
+	uint8_t tmp_sreg = SREG;
+	cli();
+	ticks = raffRuntime[channelconfig[ch].raffstate.slot].moveTicks;
+	raffRuntime[channelconfig[ch].raffstate.slot].moveTicks = 0;
+	SREG = tmp_sreg;
+
+	angleDelta = raffstore_getCalib(ch)==RAFFSTORE_CALIB_MEASURE_DOWN?channelconfig[ch].raffstate.angleClose:channelconfig[ch].raffstate.angleOpen;
+	angleTicks = angleDelta!=0?CHANNELCONFIG_RAFFSTORE_ANGLE_MAX/angleDelta:0;
+	if (ticks>angleTicks) {
+		uint32_t delta;
+		ticks -= angleTicks;
+		delta = (CHANNELCONFIG_RAFFSTORE_POSITION_MAX+ticks/2)/ticks;
+		if (delta>255) delta = 255;
+		if (delta==0) delta = 1;
+		if (raffstore_getCalib(ch)==RAFFSTORE_CALIB_MEASURE_DOWN) {
+			channelconfig[ch].raffstate.positionDown = delta;
+		} else {
+			channelconfig[ch].raffstate.positionUp = delta;
+		}
+	}
+
+	tmp_sreg = SREG;
+	cli();
+	if (raffstore_getCalib(ch)==RAFFSTORE_CALIB_MEASURE_DOWN) {
+		channelconfig[ch].raffstate.position = CHANNELCONFIG_RAFFSTORE_POSITION_MAX;
+		channelconfig[ch].raffstate.angle = CHANNELCONFIG_RAFFSTORE_ANGLE_MAX;
+		raffstore_setTarget(ch,0,0,raffstore_calibOverrun(ch,false));
+		raffstore_setCalib(ch,RAFFSTORE_CALIB_MEASURE_UP);
+	} else {
+		channelconfig[ch].raffstate.position = 0;
+		channelconfig[ch].raffstate.angle = 0;
+		raffstore_setTarget(ch,0,0,0);
+		raffRuntime[channelconfig[ch].raffstate.slot].resync = 1;
+		raffstore_setCalib(ch,RAFFSTORE_CALIB_NONE);
+	}
+	SREG = tmp_sreg;
+	if (raffstore_getCalib(ch)==RAFFSTORE_CALIB_NONE) {
+		raffstore_calibDone(ch);
+	}
+}
+#endif
+
+#ifdef CONFIG_TEMP
+//latest value of a temperature channel in 0.1°C, false if there is none yet or it is too old.
+//stale is set once the sensor missed CHANNELCONFIG_THERMOSTAT_STALE intervals
+static bool thermostat_getTemperature(uint8_t ch, int16_t *value, bool *stale) {
+	uint8_t valid,age,intervall;
+	switch (channelconfig[ch].function) {
+	case FUNCTION_TEMPSENS:
+		*value = channelconfig[ch].tempstate.value*10;
+		valid = channelconfig[ch].tempstate.valid;
+		age = channelconfig[ch].tempstate.age;
+		intervall = channelconfig[ch].tempstate.intervall;
+		break;
+#ifdef CONFIG_KWB
+	case FUNCTION_KWB_TEMP:
+		*value = channelconfig[ch].kwbtemp.value*10;
+		valid = channelconfig[ch].kwbtemp.valid;
+		age = channelconfig[ch].kwbtemp.age;
+		intervall = channelconfig[ch].kwbtemp.intervall;
+		break;
+#endif
+	default:
+		*stale = true;
+		return false;
+	}
+	//intervall 0 lets the counter wrap after 256s
+	*stale = age>=(intervall==0?0xFF:(uint16_t)intervall*CHANNELCONFIG_THERMOSTAT_STALE);
+	return valid && !*stale;
+}
+
+static void thermostat_reportStale(uint8_t ch) {
+	homecan_t msg;
+	msg.header.priority = HOMECAN_HEADER_PRIO_DEFAULT;
+	msg.header.mode = HOMECAN_HEADER_MODE_SRC;
+	msg.msgtype = HOMECAN_MSGTYPE_ERROR;
+	msg.address = homecan_getDeviceID();
+	msg.channel = ch;
+	msg.length = 2;
+	msg.data[0] = HOMECAN_ERROR_SENSOR_STALE;
+	msg.data[1] = channelconfig[ch].thermostat.sensor;
+	transmitState(&msg);
+}
+
+static void thermostat_drive(uint8_t ch, uint8_t on, uint8_t output) {
+	switch (channelconfig[ch].function) {
+#ifdef CONFIG_OUTPUT
+	case FUNCTION_OUTPUT:
+		channelconfig_setPort(channelconfig[ch].port[0],on);
+		if (channelconfig[ch].state!=on) {
+			channelconfig[ch].state = on;
+			channelconfig[ch].changed = 1;
+		}
+		break;
+#endif
+#ifdef CONFIG_SSR
+	case FUNCTION_SSR:
+		ssr_switch(&channelconfig[ch].ssrstate,on);
+		break;
+#endif
+#ifdef CONFIG_POTIO
+	case FUNCTION_KWB_HK:
+		//continuous, output moves the wiper between night and day
+		channelconfig[ch].kwbhk.mode = KWB_HK_MODE_THERMOSTAT;
+		channelconfig[ch].kwbhk.position = CHANNELCONFIG_KWB_HK_NIGHT+((uint16_t)(CHANNELCONFIG_KWB_HK_DAY-CHANNELCONFIG_KWB_HK_NIGHT))*output/100;
+		mcp4651_setWiperAsync(channelconfig[ch].kwbhk.hk,channelconfig[ch].kwbhk.position);
+		channelconfig[ch].changed = 1;
+		break;
+#endif
+	default:
+		break;
+	}
+}
+
+//fixed point PID, returns the output in %, called once per cycle
+static uint8_t thermostat_pid(thermostat_t *t, int16_t error) {
+	uint16_t dt = t->period*10;
+	int32_t out,integral;
+	integral = t->ki?t->integral + (int32_t)error*dt:0;
+	out = (int32_t)t->kp*error/10
+		+ (int32_t)t->ki*(integral/60)/10
+		+ (int32_t)t->kd*(error-t->lastError)*60/(10*(int32_t)dt);
+	t->lastError = error;
+	//anti windup: stop integrating while saturated
+	if (out>100) {
+		out = 100;
+		if (error<0) t->integral = integral;
+	} else if (out<0) {
+		out = 0;
+		if (error>0) t->integral = integral;
+	} else {
+		t->integral = integral;
+	}
+	return out;
+}
+
+#ifdef CONFIG_POTIO
+//a thermostat drives this KWB_HK channel
+static bool thermostat_ownsActuator(uint8_t actuator) {
+	uint8_t ch;
+	for (ch=0;ch<=CHANNELCONFIG_MAX_CONFIG;ch++) {
+		if (channelconfig[ch].function==FUNCTION_THERMOSTAT && channelconfig[ch].thermostat.actuator==actuator) return true;
+	}
+	return false;
+}
+#endif
+
+//control loop, called every second
+static void thermostat_step(uint8_t ch) {
+	thermostat_t *t = &channelconfig[ch].thermostat;
+	int16_t temperature;
+	uint8_t on,output;
+	bool stale;
+	if (t->sensor>CHANNELCONFIG_MAX_CONFIG || t->actuator>CHANNELCONFIG_MAX_CONFIG) return;
+	if (!thermostat_getTemperature(t->sensor,&temperature,&stale)) {
+		//no value yet or an old one: actuator off instead of acting on it
+		if (t->on || t->output!=0) {
+			thermostat_drive(t->actuator,0,0);
+			t->on = 0;
+			t->output = 0;
+			channelconfig[ch].changed = 1;
+		}
+		if (stale && !t->stale) {
+			t->stale = 1;
+			thermostat_reportStale(ch);
+		}
+		return;
+	}
+	if (t->stale) {
+		//sensor is back, start a new cycle
+		t->stale = 0;
+		t->timer = 0;
+	}
+	output = t->output;
+	if (t->mode==THERMOSTAT_HYSTERESIS) {
+		if (temperature<=t->setpoint-t->hysteresis) {
+			output = 100;
+		} else if (temperature>=t->setpoint+t->hysteresis) {
+			output = 0;
+		}
+	} else if (t->timer==0) {
+		output = thermostat_pid(t,t->setpoint-temperature);
+	}
+	//time-proportioned output
+	on = output>=CHANNELCONFIG_THERMOSTAT_MIN_ON && t->timer<((uint32_t)t->period*10*output)/100;
+	t->timer++;
+	if (t->timer>=t->period*10) {
+		t->timer = 0;
+	}
+	if (on!=t->on || output!=t->output) {
+		thermostat_drive(t->actuator,on,output);
+		t->on = on;
+		t->output = output;
+		channelconfig[ch].changed = 1;
+	}
+}
+#endif
+
+//actions a slot can hold, at most two data bytes and nothing that reconfigures the node
+static bool schedule_isAction(uint8_t msgtype) {
+	switch (msgtype) {
+	case HOMECAN_MSGTYPE_ERROR:
+	case HOMECAN_MSGTYPE_TIME:
+	case HOMECAN_MSGTYPE_SCHEDULE:
+#ifdef CONFIG_TEMP
+	case HOMECAN_MSGTYPE_PID:
+#endif
+#ifdef CONFIG_KEYPAD
+	case HOMECAN_MSGTYPE_KEYPAD_CODE:
+#endif
+#ifdef CONFIG_IR
+	case HOMECAN_MSGTYPE_IR:
+#endif
+		return false;
+	case HOMECAN_MSGTYPE_REQUEST_STATE:
+		return true;
+	default:
+		//config and system range
+		return msgtype<HOMECAN_MSGTYPE_CHANNEL_CONFIG;
+	}
+}
+
+static void schedule_read(uint8_t slot, scheduleentry_t *entry) {
+	eeprom_read_block(entry,(uint8_t *)(EEPROM_SCHEDULE+slot*sizeof(scheduleentry_t)),sizeof(scheduleentry_t));
+}
+
+//pick the random delays of all entries for a new day
+static void schedule_randomize(void) {
+	scheduleentry_t entry;
+	uint8_t slot;
+	for (slot=0;slot<CHANNELCONFIG_SCHEDULE_SLOTS;slot++) {
+		schedule_read(slot,&entry);
+		scheduleOffset[slot] = 0;
+		if (entry.random!=0 && entry.random!=0xFF) {
+			scheduleOffset[slot] = random()%(entry.random*60UL+1);
+			if (entry.minute*60UL+scheduleOffset[slot]>=86400UL) {
+				//stay on the same day
+				scheduleOffset[slot] = 86399UL-entry.minute*60UL;
+			}
+		}
+	}
+}
+
+//mark all entries due between the last call and now, called every second
+static void schedule_evaluate(void) {
+	scheduleentry_t entry;
+	uint32_t now,t,second;
+	uint8_t ticks,slot,weekday;
+	if (!homecan_getTime(&now,&ticks)) return;
+	now += (int32_t)channelconfig[scheduleChannel].schedulestate.utcOffset*900;
+	if (scheduleLast==0 || now<=scheduleLast || now-scheduleLast>CHANNELCONFIG_SCHEDULE_CATCHUP) {
+		//first run or clock stepped
+		schedule_randomize();
+		scheduleLast = now;
+		return;
+	}
+	for (t=scheduleLast+1;t<=now;t++) {
+		second = t%86400UL;
+		weekday = ((t/86400UL)+3)%7;	//1.1.1970 was a thursday
+		if (second==0) {
+			schedule_randomize();
+		}
+		for (slot=0;slot<CHANNELCONFIG_SCHEDULE_SLOTS;slot++) {
+			schedule_read(slot,&entry);
+			if (entry.weekdays==0 || entry.weekdays==0xFF) continue;
+			if (((entry.weekdays>>weekday)&0x01) && second==entry.minute*60UL+scheduleOffset[slot]) {
+				scheduleDue |= 1<<slot;
+			}
+		}
+	}
+	scheduleLast = now;
+}
+
+//returns the next due action as a frame to this device
+static bool schedule_next(homecan_t *msg) {
+	scheduleentry_t entry;
+	uint8_t slot;
+	if (scheduleDue==0) return false;
+	for (slot=0;slot<CHANNELCONFIG_SCHEDULE_SLOTS;slot++) {
+		if ((scheduleDue>>slot)&0x01) {
+			scheduleDue &= ~(1<<slot);
+			schedule_read(slot,&entry);
+			if (!schedule_isAction(entry.msgtype)) continue;	//stored by older firmware
+			msg->header.priority = HOMECAN_HEADER_PRIO_DEFAULT;
+			msg->header.mode = HOMECAN_HEADER_MODE_DST;
+			msg->msgtype = entry.msgtype;
+			msg->address = homecan_getDeviceID();
+			msg->channel = entry.channel;
+			memset(msg->data,0,sizeof(msg->data));
+			msg->length = 2;
+			msg->data[0] = entry.value;
+			msg->data[1] = entry.valueHigh;
+			channelconfig[scheduleChannel].schedulestate.lastSlot = slot;
+			channelconfig[scheduleChannel].changed = 1;
+			return true;
+		}
+	}
+	return false;
+}
+
+#if defined(CONFIG_ELTAKO) || defined(CONFIG_KWB)
+static void channelconfig_transmitBusStats(uint8_t uart, uint8_t protocol, uint16_t frames, uint16_t checksumErrors) {
+	homecan_t msg;
+	msg.header.priority = HOMECAN_HEADER_PRIO_DEFAULT;
+	msg.header.mode = HOMECAN_HEADER_MODE_SRC;
+	msg.msgtype = HOMECAN_MSGTYPE_BUS_STATS;
+	msg.address = homecan_getDeviceID();
+	msg.channel = uart;
+	msg.length = HOMECAN_BUS_STATS_LENGTH;
+	msg.data[0] = protocol;
+	msg.data[1] = frames&0xFF;
+	msg.data[2] = frames>>8;
+	msg.data[3] = checksumErrors&0xFF;
+	msg.data[4] = checksumErrors>>8;
+	while (!homecan_transmit(&msg)) {
+		_delay_ms(1);
+	}
+}
+
+//one frame per RS485 bus
+static void channelconfig_reportBusStats(void) {
+	uint8_t uart;
+	uint16_t frames,checksumErrors;
+	for (uart=0;uart<2;uart++) {
+#ifdef CONFIG_ELTAKO
+		if ((CONFIG_ELTAKO_UARTS>>uart)&0x01) {
+			rs485eltako_getStats(&eltakoBus[uart],&frames,&checksumErrors);
+			channelconfig_transmitBusStats(uart,HOMECAN_BUS_ELTAKO,frames,checksumErrors);
 		}
-		break;
 #endif
-#ifdef CONFIG_HOMECAN_GATEWAY
-	case FUNCTION_BUSLOAD:
-		if (channelconfig_getPortType(config->port[0])==CIRCUIT_NONE) {
-			busloadChannel = channel;
-		} else {
-			return false;
+#ifdef CONFIG_KWB
+		if ((CONFIG_KWB_UARTS>>uart)&0x01) {
+			rs485kwb_getStats(&kwbBus[uart],&frames,&checksumErrors);
+			channelconfig_transmitBusStats(uart,HOMECAN_BUS_KWB,frames,checksumErrors);
 		}
-		break;
 #endif
-	case FUNCTION_NONE:
-		break;
-	default:
-		return false;
-		break;
 	}
-	memcpy(&channelconfig[channel],config,sizeof(channelconfig_t));
-	return true;
 }
+#endif
 
 void channelconfig_receiveTask(void) {
 	homecan_t msg;
+#if defined(CONFIG_ELTAKO) || defined(CONFIG_KWB)
+	uint8_t uart;
+#endif
 
 #ifdef CONFIG_ELTAKO
-	//check for rs485 messages
-	rs485eltakoReceiveTask();
+	//check for rs485 messages, each bus has its own UART queues
+	for (uart=0;uart<2;uart++) {
+		if ((CONFIG_ELTAKO_UARTS>>uart)&0x01) rs485eltakoReceiveTask(&eltakoBus[uart]);
+	}
 #endif
 #ifdef CONFIG_KWB
-	rs485kwbReceiveTask();
+	for (uart=0;uart<2;uart++) {
+		if ((CONFIG_KWB_UARTS>>uart)&0x01) rs485kwbReceiveTask(&kwbBus[uart]);
+	}
 #endif
 
-	//check for incoming can messages
-	while (homecan_receive(&msg)) {
+	//check for incoming can messages, then for due scheduled actions
+	while (homecan_receive(&msg) || schedule_next(&msg)) {
 #ifdef CONFIG_HOMECAN_GATEWAY
 		if (busloadChannel!=0) {
 			channelconfig[busloadChannel].busloadstate.byteCount += msg.length+8;
@@ -831,6 +1999,7 @@ void channelconfig_receiveTask(void) {
 							config.raffstate.positionDown = msg.data[4];
 							config.raffstate.angleOpen = msg.data[5];
 							config.raffstate.angleClose= msg.data[6];
+							config.raffstate.reportDelta = (msg.length>7 && msg.data[7]!=0)?msg.data[7]:CHANNELCONFIG_RAFFSTORE_REPORT_DELTA;
 
 							config.raffstate.positionTarget = 0;
 							config.raffstate.angleTarget = 0;
@@ -839,6 +2008,13 @@ void channelconfig_receiveTask(void) {
 							config.raffstate.mode = RAFFSTORE_MOVE;
 							config.raffstate.wait = 0;
 							break;
+						case FUNCTION_RAFFSTORE_SCHEDULER:
+							config.port[0] = msg.data[1];
+							config.raffschedstate.maxStarts = msg.data[2];
+							config.raffschedstate.stagger = msg.data[3];
+							config.raffschedstate.queued = 0;
+							config.raffschedstate.inrush = 0;
+							break;
 #endif
 #ifdef CONFIG_SSR
 						case FUNCTION_SSR:
@@ -854,9 +2030,7 @@ void channelconfig_receiveTask(void) {
 							txMsg.id = msg.channel;
 							txMsg.org = RS485ELTAKO_ORG_4BS;
 							txMsg.data = rs485eltako_createDimmerValue(0);
-							while (!rs485eltako_transmitMessage(&txMsg)) {
-								_delay_ms(1);
-							}
+							channelconfig_eltakoTransmit(config.port[0],&txMsg);
 							config.dimmerstate.value = 0;
 							break;
 						case FUNCTION_FTK:
@@ -875,6 +2049,17 @@ void channelconfig_receiveTask(void) {
 							config.tempstate.value = 0.0;
 							config.tempstate.intervall = msg.data[3];
 							config.tempstate.counter = 0;
+							config.tempstate.valid = 0;
+							config.tempstate.age = 0;
+							break;
+						case FUNCTION_THERMOSTAT:
+							config.port[0] = msg.data[1];
+							config.thermostat.sensor = msg.data[2];
+							config.thermostat.actuator = msg.data[3];
+							config.thermostat.mode = msg.data[4];
+							config.thermostat.hysteresis = msg.data[5];
+							config.thermostat.period = msg.data[6];
+							config.thermostat.setpoint = CHANNELCONFIG_THERMOSTAT_SETPOINT_DEFAULT;
 							break;
 #endif
 #ifdef CONFIG_LED
@@ -889,6 +2074,7 @@ void channelconfig_receiveTask(void) {
 							config.port[0] = msg.data[1];
 							config.changed = 1;
 							config.buzzerstate.freq = 0;
+							config.buzzerstate.pattern = BUZZER_PATTERN_NONE;
 							break;
 #endif
 #ifdef CONFIG_IR
@@ -903,6 +2089,11 @@ void channelconfig_receiveTask(void) {
 							config.port[0] = msg.data[1];
 							config.changed = 1;
 							config.state = 0;
+							if (msg.length>=6) {
+								config.motionstate.hold = msg.data[2] | (((uint16_t)msg.data[3])<<8);
+								config.motionstate.minOff = msg.data[4];
+								config.motionstate.countIntervall = msg.data[5];
+							}
 							break;
 #endif
 #ifdef CONFIG_ANALOG
@@ -939,12 +2130,21 @@ void channelconfig_receiveTask(void) {
 							config.kwbtemp.channel = msg.data[3];
 							config.kwbtemp.intervall = msg.data[4];
 							config.kwbtemp.counter = 0;
+							config.kwbtemp.valid = 0;
+							config.kwbtemp.age = 0;
 							break;
 #ifdef CONFIG_POTIO
 						case FUNCTION_KWB_HK:
 							config.port[0] = msg.data[1];
 							config.kwbhk.hk = msg.data[3];
 							config.kwbhk.mode = 2;	//Automatik Mode
+							config.kwbhk.sense = 0xFF;
+							config.kwbhk.intervall = CHANNELCONFIG_KWB_HK_INTERVALL_DEFAULT;
+							if (msg.length>=6) {
+								config.kwbhk.sense = msg.data[4];
+								config.kwbhk.intervall = msg.data[5];
+							}
+							config.kwbhk.position = CHANNELCONFIG_KWB_HK_AUTO;
 							break;
 #endif
 #endif
@@ -957,6 +2157,19 @@ void channelconfig_receiveTask(void) {
 							config.busloadstate.intervall = msg.data[3];
 							break;
 #endif
+						case FUNCTION_SCHEDULER:
+							config.port[0] = msg.data[1];
+							config.schedulestate.utcOffset = msg.data[2];
+							config.schedulestate.lastSlot = 0xFF;
+							break;
+						case FUNCTION_CLOCK:
+							config.port[0] = msg.data[1];
+							config.clockstate.flags = msg.data[2];
+							if (msg.length>=7) {
+								memcpy(config.clockstate.ntpip,&msg.data[3],4);
+							}
+							config.clockstate.timer = 0;
+							break;
 						}
 						config.changed = 1;
 						channelconfig_configure(msg.channel,&config);
@@ -978,6 +2191,11 @@ void channelconfig_receiveTask(void) {
 					channelconfig[msg.channel].changed = 1;
 					//transmitChannelState(msg.channel);
 					break;
+#if defined(CONFIG_ELTAKO) || defined(CONFIG_KWB)
+				case HOMECAN_MSGTYPE_BUS_STATS:
+					channelconfig_reportBusStats();
+					break;
+#endif
 				case HOMECAN_MSGTYPE_ONOFF:
 #ifdef CONFIG_OUTPUT
 					if (channelconfig[msg.channel].function==FUNCTION_OUTPUT) {
@@ -986,13 +2204,8 @@ void channelconfig_receiveTask(void) {
 #endif
 #ifdef CONFIG_SSR
 					if (channelconfig[msg.channel].function==FUNCTION_SSR) {
-						uint8_t loop = 1;
-						while (msg.data[0]!=channelconfig_getPort(channelconfig[msg.channel].port[1]) && loop <= CHANNELCONFIG_SSR_MAX_REPEAT) {
-							channelconfig_setPort(channelconfig[msg.channel].port[0], 0x01);
-							_delay_ms(CHANNELCONFIG_SSR_DELAY_MS * loop);
-							channelconfig_setPort(channelconfig[msg.channel].port[0], 0x00);
-							loop++;
-						}
+						//pulsing and feedback check is done in 10ms ISR
+						ssr_switch(&channelconfig[msg.channel].ssrstate,msg.data[0]!=0);
 					}
 #endif
 #ifdef CONFIG_ELTAKO
@@ -1001,9 +2214,7 @@ void channelconfig_receiveTask(void) {
 						txMsg.id = msg.channel;
 						txMsg.org = RS485ELTAKO_ORG_4BS;
 						txMsg.data = rs485eltako_createDimmerValue(msg.data[0]==0?0:255);
-						while (!rs485eltako_transmitMessage(&txMsg)) {
-							_delay_ms(1);
-						}
+						channelconfig_eltakoTransmit(channelconfig[msg.channel].port[0],&txMsg);
 						channelconfig[msg.channel].changed = 1;
 						channelconfig[msg.channel].dimmerstate.value = msg.data[0]==0?0:255;
 					}
@@ -1023,9 +2234,7 @@ void channelconfig_receiveTask(void) {
 						txMsg.id = msg.channel;
 						txMsg.org = RS485ELTAKO_ORG_4BS;
 						txMsg.data = rs485eltako_createDimmerValue(msg.data[0]);
-						while (!rs485eltako_transmitMessage(&txMsg)) {
-							_delay_ms(1);
-						}
+						channelconfig_eltakoTransmit(channelconfig[msg.channel].port[0],&txMsg);
 						channelconfig[msg.channel].changed = 1;
 						channelconfig[msg.channel].dimmerstate.value = msg.data[0];
 					}
@@ -1036,49 +2245,69 @@ void channelconfig_receiveTask(void) {
 						txMsg.id = msg.channel;
 						txMsg.org = RS485ELTAKO_ORG_4BS;
 						txMsg.data = RS485ELTAKO_DIMMER_LEARN;
-						while (!rs485eltako_transmitMessage(&txMsg)) {
-							_delay_ms(1);
-						}
+						channelconfig_eltakoTransmit(channelconfig[msg.channel].port[0],&txMsg);
 					}
 					break;
 #endif
 #ifdef CONFIG_RAFFSTORE
 				case HOMECAN_MSGTYPE_POSITION:
 					if (channelconfig[msg.channel].function==FUNCTION_RAFFSTORE) {
-						channelconfig[msg.channel].raffstate.positionTarget = (((uint32_t)msg.data[0])*CHANNELCONFIG_RAFFSTORE_POSITION_MAX)/255;
-						if (channelconfig[msg.channel].raffstate.mode==RAFFSTORE_IDLE) {
-							channelconfig[msg.channel].raffstate.mode = RAFFSTORE_MOVE;
-						}
+						raffstore_moveTo(msg.channel,(((uint32_t)msg.data[0])*CHANNELCONFIG_RAFFSTORE_POSITION_MAX)/255,channelconfig[msg.channel].raffstate.angleTarget);
 					}
 					break;
 				case HOMECAN_MSGTYPE_SHADE:
 					if (channelconfig[msg.channel].function==FUNCTION_RAFFSTORE) {
-						channelconfig[msg.channel].raffstate.angleTarget = (((uint32_t)msg.data[0])*CHANNELCONFIG_RAFFSTORE_ANGLE_MAX)/255;
-						if (channelconfig[msg.channel].raffstate.mode==RAFFSTORE_IDLE) {
-							channelconfig[msg.channel].raffstate.mode = RAFFSTORE_MOVE;
-						}
+						raffstore_moveTo(msg.channel,channelconfig[msg.channel].raffstate.positionTarget,(((uint32_t)msg.data[0])*CHANNELCONFIG_RAFFSTORE_ANGLE_MAX)/255);
 					}
 					break;
 				case HOMECAN_MSGTYPE_UPDOWN:
 					if (channelconfig[msg.channel].function==FUNCTION_RAFFSTORE) {
 						if (msg.data[0]==0) {
-							channelconfig[msg.channel].raffstate.positionTarget = 0;
-							channelconfig[msg.channel].raffstate.angleTarget = 0;
+							raffstore_moveTo(msg.channel,0,0);
 						} else {
-							channelconfig[msg.channel].raffstate.positionTarget = CHANNELCONFIG_RAFFSTORE_POSITION_MAX;
-							channelconfig[msg.channel].raffstate.angleTarget = CHANNELCONFIG_RAFFSTORE_ANGLE_MAX;
-						}
-						if (channelconfig[msg.channel].raffstate.mode==RAFFSTORE_IDLE) {
-							channelconfig[msg.channel].raffstate.mode = RAFFSTORE_MOVE;
+							raffstore_moveTo(msg.channel,CHANNELCONFIG_RAFFSTORE_POSITION_MAX,CHANNELCONFIG_RAFFSTORE_ANGLE_MAX);
 						}
 					}
 					break;
 				case HOMECAN_MSGTYPE_STOPMOVE:
 					if (channelconfig[msg.channel].function==FUNCTION_RAFFSTORE) {
-						channelconfig[msg.channel].raffstate.angleTarget = channelconfig[msg.channel].raffstate.angle;
-						channelconfig[msg.channel].raffstate.positionTarget = channelconfig[msg.channel].raffstate.position;
-						if (channelconfig[msg.channel].raffstate.mode==RAFFSTORE_IDLE) {
-							channelconfig[msg.channel].raffstate.mode = RAFFSTORE_MOVE;
+						if (raffstore_getCalib(msg.channel)==RAFFSTORE_CALIB_MEASURE_DOWN || raffstore_getCalib(msg.channel)==RAFFSTORE_CALIB_MEASURE_UP) {
+							//end stop reached during travel time measurement
+							raffstore_calibMark(msg.channel);
+						} else {
+							uint8_t tmp_sreg = SREG;
+							cli();
+							if (raffRuntime[channelconfig[msg.channel].raffstate.slot].resync && (channelconfig[msg.channel].raffstate.position==0 || channelconfig[msg.channel].raffstate.position==CHANNELCONFIG_RAFFSTORE_POSITION_MAX)) {
+								//stopped while driving against the end stop, the travel is no partial move
+								raffRuntime[channelconfig[msg.channel].raffstate.slot].moveTicks = 0;
+							}
+							SREG = tmp_sreg;
+							raffstore_setCalib(msg.channel,RAFFSTORE_CALIB_NONE);
+							raffstore_setTarget(msg.channel,channelconfig[msg.channel].raffstate.position,channelconfig[msg.channel].raffstate.angle,0);
+						}
+					}
+					break;
+				case HOMECAN_MSGTYPE_CALIBRATE:
+					//one run per node, a request for another channel waits until it is done
+					if (channelconfig[msg.channel].function==FUNCTION_RAFFSTORE && (raffCalib==RAFFSTORE_CALIB_NONE || raffCalibChannel==msg.channel)) {
+						if (msg.data[0]==RAFFSTORE_CALIB_RESYNC) {
+							//remember the target and resync at the nearest end stop
+							uint8_t position = (((uint32_t)channelconfig[msg.channel].raffstate.positionTarget)*255)/CHANNELCONFIG_RAFFSTORE_POSITION_MAX;
+							uint8_t angle = (((uint32_t)channelconfig[msg.channel].raffstate.angleTarget)*255)/CHANNELCONFIG_RAFFSTORE_ANGLE_MAX;
+							if (channelconfig[msg.channel].raffstate.position<CHANNELCONFIG_RAFFSTORE_POSITION_MAX/2) {
+								raffstore_moveTo(msg.channel,0,0);
+							} else {
+								raffstore_moveTo(msg.channel,CHANNELCONFIG_RAFFSTORE_POSITION_MAX,CHANNELCONFIG_RAFFSTORE_ANGLE_MAX);
+							}
+							raffCalibPosition = position;
+							raffCalibAngle = angle;
+							raffstore_setCalib(msg.channel,RAFFSTORE_CALIB_RESYNC);
+						} else if (msg.data[0]==RAFFSTORE_CALIB_MEASURE_TOP) {
+							//measure travel times: upper end stop, down until marked, up until marked
+							raffstore_moveTo(msg.channel,0,0);
+							raffstore_setCalib(msg.channel,RAFFSTORE_CALIB_MEASURE_TOP);
+						} else {
+							raffstore_setCalib(msg.channel,RAFFSTORE_CALIB_NONE);
 						}
 					}
 					break;
@@ -1103,9 +2332,7 @@ void channelconfig_receiveTask(void) {
 						txMsg.id = msg.channel;
 						txMsg.org = RS485ELTAKO_ORG_4BS;
 						txMsg.data = rs485eltako_createDimmerValue(channelconfig[msg.channel].dimmerstate.value);
-						while (!rs485eltako_transmitMessage(&txMsg)) {
-							_delay_ms(1);
-						}
+						channelconfig_eltakoTransmit(channelconfig[msg.channel].port[0],&txMsg);
 						channelconfig[msg.channel].changed = 1;
 					}
 					break;
@@ -1113,10 +2340,20 @@ void channelconfig_receiveTask(void) {
 #ifdef CONFIG_BUZZER
 				case HOMECAN_MSGTYPE_BUZZER:
 					if (channelconfig[msg.channel].function==FUNCTION_BUZZER) {
+						//continuous tone, stops a running pattern
+						channelconfig_playBuzzer(BUZZER_PATTERN_NONE,0);
 						channelconfig[msg.channel].buzzerstate.freq = msg.data[0] + (((uint16_t)msg.data[1])<<8);
+						channelconfig_setBuzzer(channelconfig[msg.channel].buzzerstate.freq);
 						channelconfig[msg.channel].changed = 1;
 					}
 					break;
+				case HOMECAN_MSGTYPE_BUZZER_PATTERN:
+					if (channelconfig[msg.channel].function==FUNCTION_BUZZER) {
+						//data[0] pattern (0xFF stops), data[1] repeats (0 until stopped)
+						channelconfig[msg.channel].buzzerstate.freq = 0;
+						channelconfig_playBuzzer(msg.data[0],msg.length>1?msg.data[1]:1);
+					}
+					break;
 #endif
 #ifdef CONFIG_IR
 				case HOMECAN_MSGTYPE_IR:
@@ -1134,30 +2371,123 @@ void channelconfig_receiveTask(void) {
 #ifdef CONFIG_POTIO
 				case HOMECAN_MSGTYPE_KWB_HK:
 					if (channelconfig[msg.channel].function==FUNCTION_KWB_HK) {
+	#ifdef CONFIG_TEMP
+						if (msg.data[0]==KWB_HK_MODE_SETPOINT && thermostat_ownsActuator(msg.channel)) break;
+	#endif
 						channelconfig[msg.channel].kwbhk.mode = msg.data[0];
 						switch (channelconfig[msg.channel].kwbhk.mode) {
 						case 0:
-							mcp4651_setWiper(channelconfig[msg.channel].kwbhk.hk,CHANNELCONFIG_KWB_HK_OFF);
+							channelconfig[msg.channel].kwbhk.position = CHANNELCONFIG_KWB_HK_OFF;
 							break;
 						case 1:
-							mcp4651_setWiper(channelconfig[msg.channel].kwbhk.hk,CHANNELCONFIG_KWB_HK_NIGHT);
+							channelconfig[msg.channel].kwbhk.position = CHANNELCONFIG_KWB_HK_NIGHT;
 							break;
 						case 2:
-							mcp4651_setWiper(channelconfig[msg.channel].kwbhk.hk,CHANNELCONFIG_KWB_HK_DAY);
+							channelconfig[msg.channel].kwbhk.position = CHANNELCONFIG_KWB_HK_DAY;
 							break;
 						case 3:
-							mcp4651_setWiper(channelconfig[msg.channel].kwbhk.hk,CHANNELCONFIG_KWB_HK_AUTO);
+							channelconfig[msg.channel].kwbhk.position = CHANNELCONFIG_KWB_HK_AUTO;
+							break;
+						case KWB_HK_MODE_SETPOINT:
+							//start stepping from the current wiper
+							channelconfig[msg.channel].kwbhk.timer = 0;
 							break;
 						}
+						mcp4651_setWiperAsync(channelconfig[msg.channel].kwbhk.hk,channelconfig[msg.channel].kwbhk.position);
+						channelconfig[msg.channel].changed = 1;
+					}
+					break;
+#endif
+#endif
+#ifdef CONFIG_TEMP
+				case HOMECAN_MSGTYPE_SETPOINT:
+					//data[0..1] 0.1°C
+					if (channelconfig[msg.channel].function==FUNCTION_THERMOSTAT) {
+						channelconfig[msg.channel].thermostat.setpoint = msg.data[0] | (((uint16_t)msg.data[1])<<8);
+						channelconfig[msg.channel].changed = 1;
+					}
+#ifdef CONFIG_POTIO
+					if (channelconfig[msg.channel].function==FUNCTION_KWB_HK && !thermostat_ownsActuator(msg.channel)) {
+						channelconfig[msg.channel].kwbhk.target = msg.data[0] | (((uint16_t)msg.data[1])<<8);
+						channelconfig[msg.channel].kwbhk.mode = KWB_HK_MODE_SETPOINT;
 						channelconfig[msg.channel].changed = 1;
 					}
+#endif
+					break;
+				case HOMECAN_MSGTYPE_PID:
+					//data[0] kp, data[1] ki, data[2] kd
+					if (channelconfig[msg.channel].function==FUNCTION_THERMOSTAT) {
+						channelconfig[msg.channel].thermostat.kp = msg.data[0];
+						channelconfig[msg.channel].thermostat.ki = msg.data[1];
+						channelconfig[msg.channel].thermostat.kd = msg.data[2];
+						channelconfig[msg.channel].thermostat.integral = 0;
+					}
 					break;
 #endif
+				case HOMECAN_MSGTYPE_SCHEDULE:
+					//data[0] slot, data[1] weekdays, data[2..3] minute, data[4] channel, data[5] msgtype, data[6] value, data[7] random, only slot reads back
+					//data[0] slot|CHANNELCONFIG_SCHEDULE_HIGH, data[1] second data byte of the action, only slot reads back
+					if (channelconfig[msg.channel].function==FUNCTION_SCHEDULER && msg.data[0]&CHANNELCONFIG_SCHEDULE_HIGH
+							&& (msg.data[0]&~CHANNELCONFIG_SCHEDULE_HIGH)<CHANNELCONFIG_SCHEDULE_SLOTS) {
+						uint8_t *high = (uint8_t *)(EEPROM_SCHEDULE+(msg.data[0]&~CHANNELCONFIG_SCHEDULE_HIGH)*sizeof(scheduleentry_t)+offsetof(scheduleentry_t,valueHigh));
+						if (msg.length==2) {
+							eeprom_update_byte(high,msg.data[1]);
+						}
+						msg.header.mode = HOMECAN_HEADER_MODE_SRC;
+						msg.length = 2;
+						msg.data[1] = eeprom_read_byte(high);
+						while (!homecan_transmit(&msg)) {
+							_delay_ms(1);
+						}
+					} else if (channelconfig[msg.channel].function==FUNCTION_SCHEDULER && msg.data[0]<CHANNELCONFIG_SCHEDULE_SLOTS) {
+						scheduleentry_t entry;
+						if (msg.length==8) {
+							entry.weekdays = msg.data[1];
+							entry.minute = msg.data[2] | (((uint16_t)msg.data[3])<<8);
+							entry.channel = msg.data[4];
+							entry.msgtype = msg.data[5];
+							entry.value = msg.data[6];
+							entry.random = msg.data[7];
+							entry.valueHigh = 0;	//set by a following high byte frame
+							if (entry.minute>=1440) break;
+							if (entry.weekdays!=0 && entry.weekdays!=0xFF && !schedule_isAction(entry.msgtype)) break;
+							eeprom_update_block(&entry,(uint8_t *)(EEPROM_SCHEDULE+msg.data[0]*sizeof(scheduleentry_t)),sizeof(scheduleentry_t));
+							scheduleOffset[msg.data[0]] = 0;
+						}
+						schedule_read(msg.data[0],&entry);
+						msg.header.mode = HOMECAN_HEADER_MODE_SRC;
+						msg.length = 8;
+						msg.data[1] = entry.weekdays;
+						msg.data[2] = entry.minute&0xFF;
+						msg.data[3] = entry.minute>>8;
+						msg.data[4] = entry.channel;
+						msg.data[5] = entry.msgtype;
+						msg.data[6] = entry.value;
+						msg.data[7] = entry.random;
+						while (!homecan_transmit(&msg)) {
+							_delay_ms(1);
+						}
+					}
+					break;
+#ifdef CONFIG_KEYPAD
+				case HOMECAN_MSGTYPE_KEYPAD_CODE:
+					//data[0] slot, data[1..4] hash (0xFFFFFFFF clears), data[5] address, data[6] channel, data[7] msgtype of the action
+					if (channelconfig[msg.channel].function==FUNCTION_KEYPAD && msg.length==8) {
+						channelconfig_setKeyCode(msg.data[0],
+							msg.data[1] | (((uint32_t)msg.data[2])<<8) | (((uint32_t)msg.data[3])<<16) | (((uint32_t)msg.data[4])<<24),
+							msg.data[5],msg.data[6],msg.data[7]);
+					}
+					break;
 #endif
 				case HOMECAN_MSGTYPE_BOOTLOADER:
 				case HOMECAN_MSGTYPE_CALL_BOOTLOADER: //already handled inside homecan.c
 				//all following are only updates, no plan to react on updates inside homecan, updates are handled by openhab
 				case HOMECAN_MSGTYPE_HEARTBEAT:
+#ifdef CONFIG_RAFFSTORE
+				case HOMECAN_MSGTYPE_RAFFSTORE_QUEUE:
+#else
+				case HOMECAN_MSGTYPE_STOPMOVE:	//no raffstore on this node
+#endif
 #ifdef CONFIG_MOTION
 				case HOMECAN_MSGTYPE_MOTION:
 #endif
@@ -1172,8 +2502,18 @@ void channelconfig_receiveTask(void) {
 				case HOMECAN_MSGTYPE_RAIN:
 				case HOMECAN_MSGTYPE_FLOAT:
 				case HOMECAN_MSGTYPE_UINT32:
+				case HOMECAN_MSGTYPE_ERROR:
+				case HOMECAN_MSGTYPE_TIME:	//broadcast handled inside homecan.c
+				case HOMECAN_MSGTYPE_FLASH_CRC:
+				case HOMECAN_MSGTYPE_LOG_SUBSCRIBE:
+				case HOMECAN_MSGTYPE_SAMPLER:
+#ifdef CONFIG_HOMECAN_GATEWAY
+				case HOMECAN_MSGTYPE_NODE_EVENT:
+				case HOMECAN_MSGTYPE_NODE_DIRECTORY:	//handled inside homecan.c
+#endif
 #ifdef CONFIG_KEYPAD
 				case HOMECAN_MSGTYPE_KEY_SEQUENCE:
+				case HOMECAN_MSGTYPE_KEYPAD_ACCESS:
 #endif
 				case HOMECAN_MSGTYPE_STRING:
 #ifdef CONFIG_ELTAKO
@@ -1196,37 +2536,62 @@ void channelconfig_receiveTask(void) {
 	}
 }
 
-#ifdef HEARBEAT_PERIODIC
-uint8_t hearbeatCounter = 0;
-#define HEARTBEAT_INTERVALL 30
-#endif
-
 void channelconfig_1sTask(void) {
 	uint8_t ch;
 
 #ifdef HEARBEAT_PERIODIC
 	hearbeatCounter++;
-	if (hearbeatCounter>=HEARTBEAT_INTERVALL) {
+	if (hearbeatCounter>=heartbeatIntervall) {
 		hearbeatCounter = 0;
-		homecan_transmitHeartbeat();
+		//skip if any frame of our own was sent within the interval, but not forever
+		if (homecan_getIdleTime()>=heartbeatIntervall || heartbeatSkipped>=HOMECAN_HEARTBEAT_FORCED-1) {
+			homecan_transmitHeartbeat();
+			heartbeatSkipped = 0;
+		} else {
+			heartbeatSkipped++;
+		}
+		//back off under load, jitter keeps nodes from lining up again
+		heartbeatIntervall = HOMECAN_HEARTBEAT_INTERVALL;
+		if (homecan_getBusLoad()>=HOMECAN_BUSLOAD_HIGH) heartbeatIntervall *= 2;
+		heartbeatIntervall += random()%HOMECAN_HEARTBEAT_JITTER;
 	}
+#endif
+#ifdef CONFIG_HOMECAN_UDP
+	homecan_checkNetwork();
+#endif
+#ifdef CONFIG_HOMECAN_GATEWAY
+	homecan_checkNodes();
+	homecan_checkBusLoad();
+	homecan_reportShaper();
 #endif
 	//check all channels, send updates if something changed
 	for (ch=0;ch<=CHANNELCONFIG_MAX_CONFIG;ch++) {
 		switch (channelconfig[ch].function) {
 #ifdef CONFIG_TEMP
 		case FUNCTION_TEMPSENS:
+			if (channelconfig[ch].tempstate.age<0xFF) channelconfig[ch].tempstate.age++;
 	#ifdef CONFIG_ONEWIRE
 			if (channelconfig_getPortType(channelconfig[ch].port[0])==CIRCUIT_1WIRE) {
 				if (channelconfig[ch].tempstate.counter==0) {
-					DS18X20_start_meas( DS18X20_POWER_EXTERN, NULL );
+					uint8_t res = DS18X20_start_meas( DS18X20_POWER_EXTERN, NULL );
+					if (res!=DS18X20_OK) {
+						//bus shorted, the read in the next second fails as well
+						debuglog(LOG_ONEWIRE_ERROR,ch,res);
+					}
 				} else if (channelconfig[ch].tempstate.counter==1) {
 					int16_t decicelsius;
 					float newVal;
-					DS18X20_read_decicelsius_single( id[0], &decicelsius );
-					newVal = decicelsius/10.0;
-					channelconfig[ch].tempstate.value = newVal;
-					channelconfig[ch].changed = 1;
+					uint8_t res = DS18X20_read_decicelsius_single( id[0], &decicelsius );
+					if (res==DS18X20_OK) {
+						newVal = decicelsius/10.0;
+						channelconfig[ch].tempstate.value = newVal;
+						channelconfig[ch].tempstate.valid = 1;
+						channelconfig[ch].tempstate.age = 0;
+						channelconfig[ch].changed = 1;
+					} else {
+						//keep the last value
+						debuglog(LOG_ONEWIRE_ERROR,ch,res);
+					}
 				}
 				channelconfig[ch].tempstate.counter++;
 				if (channelconfig[ch].tempstate.counter==channelconfig[ch].tempstate.intervall) {
@@ -1238,8 +2603,14 @@ void channelconfig_1sTask(void) {
 			if (channelconfig_getPortType(channelconfig[ch].port[0])==CIRCUIT_I2C) {
 				if (channelconfig[ch].tempstate.counter==0) {
 					float newVal;
+		#ifdef CONFIG_POTIO
+					//finish a queued wiper write first, both share the TWI
+					mcp4651_flush();
+		#endif
 					newVal = tmp75_readTemperature();
 					channelconfig[ch].tempstate.value = newVal;
+					channelconfig[ch].tempstate.valid = 1;
+					channelconfig[ch].tempstate.age = 0;
 					channelconfig[ch].changed = 1;
 				}
 				channelconfig[ch].tempstate.counter++;
@@ -1252,6 +2623,7 @@ void channelconfig_1sTask(void) {
 #endif
 #ifdef CONFIG_KWB
 		case FUNCTION_KWB_TEMP:
+			if (channelconfig[ch].kwbtemp.age<0xFF) channelconfig[ch].kwbtemp.age++;
 			if (channelconfig[ch].kwbtemp.counter==0) {
 				channelconfig[ch].changed = 1;
 			}
@@ -1269,6 +2641,31 @@ void channelconfig_1sTask(void) {
 				channelconfig[ch].kwbstate.counter = 0;
 			}
 			break;
+	#ifdef CONFIG_POTIO
+		case FUNCTION_KWB_HK:
+			//closed loop, one wiper step per intervall and only on fresh feedback
+			if (channelconfig[ch].kwbhk.mode==KWB_HK_MODE_SETPOINT) {
+				if (channelconfig[ch].kwbhk.timer<channelconfig[ch].kwbhk.intervall) {
+					channelconfig[ch].kwbhk.timer++;
+				} else if (channelconfig[ch].kwbhk.fresh) {
+					int16_t error = channelconfig[ch].kwbhk.target-channelconfig[ch].kwbhk.feedback;
+					uint16_t position = channelconfig[ch].kwbhk.position;
+					channelconfig[ch].kwbhk.fresh = 0;
+					if (error>CHANNELCONFIG_KWB_HK_DEADBAND && position<CHANNELCONFIG_KWB_HK_MAX) {
+						position++;
+					} else if (error<-CHANNELCONFIG_KWB_HK_DEADBAND && position>CHANNELCONFIG_KWB_HK_MIN) {
+						position--;
+					}
+					if (position!=channelconfig[ch].kwbhk.position) {
+						channelconfig[ch].kwbhk.position = position;
+						channelconfig[ch].kwbhk.timer = 0;
+						mcp4651_setWiperAsync(channelconfig[ch].kwbhk.hk,position);
+						channelconfig[ch].changed = 1;
+					}
+				}
+			}
+			break;
+	#endif
 #endif
 #ifdef CONFIG_ANALOG
 		case FUNCTION_LUMINOSITY:
@@ -1319,6 +2716,19 @@ void channelconfig_1sTask(void) {
 			}
 			break;
 #endif
+#ifdef CONFIG_MOTION
+		case FUNCTION_MOTION:
+			//periodic activity count
+			if (channelconfig[ch].motionstate.countIntervall!=0) {
+				channelconfig[ch].motionstate.countTimer++;
+				if (channelconfig[ch].motionstate.countTimer>=channelconfig[ch].motionstate.countIntervall*10) {
+					channelconfig[ch].motionstate.countTimer = 0;
+					channelconfig[ch].motionstate.countReport = 1;
+					channelconfig[ch].changed = 1;
+				}
+			}
+			break;
+#endif
 #ifdef CONFIG_HOMECAN_GATEWAY
 		case FUNCTION_BUSLOAD:		
 			channelconfig[ch].busloadstate.counter++;
@@ -1327,6 +2737,28 @@ void channelconfig_1sTask(void) {
 				channelconfig[ch].changed = 1;
 			}
 			break;
+		case FUNCTION_SCHEDULER:
+			schedule_evaluate();
+			break;
+#ifdef CONFIG_TEMP
+		case FUNCTION_THERMOSTAT:
+			thermostat_step(ch);
+			break;
+#endif
+		case FUNCTION_CLOCK:
+			//gateway gets the time per NTP and distributes it on CAN
+			channelconfig[ch].clockstate.timer++;
+			if (channelconfig[ch].clockstate.ntpip[0]!=0) {
+				uint32_t seconds;
+				uint8_t ticks;
+				if (channelconfig[ch].clockstate.timer>=(homecan_getTime(&seconds,&ticks)?CHANNELCONFIG_CLOCK_NTP_INTERVALL:CHANNELCONFIG_CLOCK_NTP_RETRY)) {
+					channelconfig[ch].clockstate.timer = 0;
+					homecan_requestTime(channelconfig[ch].clockstate.ntpip);
+				} else if (channelconfig[ch].clockstate.timer%CHANNELCONFIG_CLOCK_SYNC_INTERVALL==0) {
+					homecan_transmitTime();
+				}
+			}
+			break;
 #endif
 		default:
 			break;
@@ -1335,6 +2767,26 @@ void channelconfig_1sTask(void) {
 }
 
 
+//append the event time to a state frame if enabled and the clock is synchronized
+static void channelconfig_stamp(homecan_t *msg) {
+	uint32_t seconds,stamp;
+	uint8_t ticks;
+	if (clockChannel==0 || (channelconfig[clockChannel].clockstate.flags&CLOCK_FLAG_TIMESTAMP)==0) return;
+	if (msg->length>8-HOMECAN_TIMESTAMP_LENGTH) return;
+	if (!homecan_getTime(&seconds,&ticks)) return;
+	stamp = (seconds%86400UL)*HOMECAN_TICKS_PER_SECOND + ticks;
+	msg->data[msg->length++] = stamp&0xFF;
+	msg->data[msg->length++] = (stamp>>8)&0xFF;
+	msg->data[msg->length++] = stamp>>16;
+}
+
+static void transmitState(homecan_t *msg) {
+	channelconfig_stamp(msg);
+	while (!homecan_transmit(msg)) {
+		_delay_ms(1);
+	}
+}
+
 void transmitChannelState(uint8_t ch) {
 	//check channel, send updates if  changed
 	homecan_t msg __attribute__ ((unused));
@@ -1354,9 +2806,7 @@ void transmitChannelState(uint8_t ch) {
 			msg.channel = ch;
 			msg.length = 1;
 			msg.data[0] = channelconfig[ch].state;
-			while (!homecan_transmit(&msg)) {
-				_delay_ms(1);
-			}
+			transmitState(&msg);
 			break;
 #endif
 #ifdef CONFIG_OUTPUT
@@ -1368,9 +2818,7 @@ void transmitChannelState(uint8_t ch) {
 			msg.channel = ch;
 			msg.length = 1;
 			msg.data[0] = channelconfig[ch].state;
-			while (!homecan_transmit(&msg)) {
-				_delay_ms(1);
-			}
+			transmitState(&msg);
 			break;
 #endif
 #ifdef CONFIG_MOTION
@@ -1380,10 +2828,14 @@ void transmitChannelState(uint8_t ch) {
 			msg.msgtype = HOMECAN_MSGTYPE_MOTION;
 			msg.address = homecan_getDeviceID();
 			msg.channel = ch;
-			msg.length = 1;
+			msg.length = 3;
 			msg.data[0] = channelconfig[ch].state;
-			while (!homecan_transmit(&msg)) {
-				_delay_ms(1);
+			msg.data[1] = channelconfig[ch].motionstate.events&0xFF;
+			msg.data[2] = channelconfig[ch].motionstate.events>>8;
+			transmitState(&msg);
+			if (channelconfig[ch].motionstate.countReport) {
+				channelconfig[ch].motionstate.countReport = 0;
+				channelconfig[ch].motionstate.events = 0;
 			}
 			break;
 #endif
@@ -1396,8 +2848,14 @@ void transmitChannelState(uint8_t ch) {
 			msg.channel = ch;
 			msg.length = 1;
 			msg.data[0] = channelconfig[ch].state;
-			while (!homecan_transmit(&msg)) {
-				_delay_ms(1);
+			transmitState(&msg);
+			if (channelconfig[ch].ssrstate.error) {
+				channelconfig[ch].ssrstate.error = 0;
+				msg.msgtype = HOMECAN_MSGTYPE_ERROR;
+				msg.length = 2;
+				msg.data[0] = HOMECAN_ERROR_SSR_FEEDBACK;
+				msg.data[1] = channelconfig[ch].ssrstate.target;
+				transmitState(&msg);
 			}
 			break;
 #endif
@@ -1410,9 +2868,7 @@ void transmitChannelState(uint8_t ch) {
 			msg.channel = ch;
 			msg.length = 1;
 			msg.data[0] = channelconfig[ch].state;
-			while (!homecan_transmit(&msg)) {
-				_delay_ms(1);
-			}
+			transmitState(&msg);
 			break;
 		case FUNCTION_FTK:
 			msg.header.priority = HOMECAN_HEADER_PRIO_DEFAULT;
@@ -1422,9 +2878,7 @@ void transmitChannelState(uint8_t ch) {
 			msg.channel = ch;
 			msg.length = 1;
 			msg.data[0] = channelconfig[ch].enoceanstate.state;
-			while (!homecan_transmit(&msg)) {
-				_delay_ms(1);
-			}
+			transmitState(&msg);
 			break;
 		case FUNCTION_FRW:
 			msg.header.priority = HOMECAN_HEADER_PRIO_DEFAULT;
@@ -1434,9 +2888,7 @@ void transmitChannelState(uint8_t ch) {
 			msg.channel = ch;
 			msg.length = 1;
 			msg.data[0] = channelconfig[ch].enoceanstate.state;
-			while (!homecan_transmit(&msg)) {
-				_delay_ms(1);
-			}
+			transmitState(&msg);
 			break;
 		case FUNCTION_ENOCEAN_SNIFFER:
 			break;
@@ -1450,33 +2902,24 @@ void transmitChannelState(uint8_t ch) {
 			msg.channel = ch;
 			msg.length = 1;
 			msg.data[0] = channelconfig[ch].ledstate.mode==LED_MODE_OFF?0:1;
-			while (!homecan_transmit(&msg)) {
-				_delay_ms(1);
-			}
+			transmitState(&msg);
 			break;
 #endif
 #ifdef CONFIG_RAFFSTORE
 		case FUNCTION_RAFFSTORE:
+			//position and angle in one frame
+			raffRuntime[channelconfig[ch].raffstate.slot].reportedPosition = raffstore_getPosition(ch);
+			raffRuntime[channelconfig[ch].raffstate.slot].reportedAngle = raffstore_getAngle(ch);
 			msg.header.priority = HOMECAN_HEADER_PRIO_DEFAULT;
 			msg.header.mode = HOMECAN_HEADER_MODE_SRC;
 			msg.msgtype = HOMECAN_MSGTYPE_POSITION;
 			msg.address = homecan_getDeviceID();
 			msg.channel = ch;
-			msg.length = 1;
-			msg.data[0] = (((uint32_t)channelconfig[ch].raffstate.position)*255)/CHANNELCONFIG_RAFFSTORE_POSITION_MAX;
-			while (!homecan_transmit(&msg)) {
-				_delay_ms(1);
-			}
-			msg.header.priority = HOMECAN_HEADER_PRIO_DEFAULT;
-			msg.header.mode = HOMECAN_HEADER_MODE_SRC;
-			msg.msgtype = HOMECAN_MSGTYPE_SHADE;
-			msg.address = homecan_getDeviceID();
-			msg.channel = ch;
-			msg.length = 1;
-			msg.data[0] = (((uint32_t)channelconfig[ch].raffstate.angle)*255)/CHANNELCONFIG_RAFFSTORE_ANGLE_MAX;
-			while (!homecan_transmit(&msg)) {
-				_delay_ms(1);
-			}
+			msg.length = HOMECAN_POSITION_LENGTH;
+			msg.data[0] = raffRuntime[channelconfig[ch].raffstate.slot].reportedPosition;
+			msg.data[1] = raffRuntime[channelconfig[ch].raffstate.slot].reportedAngle;
+			msg.data[2] = raffRuntime[channelconfig[ch].raffstate.slot].drift>2550?255:raffRuntime[channelconfig[ch].raffstate.slot].drift/10;	//estimated drift in 0,1s
+			transmitState(&msg);
 			/*
 			msg.header.priority = HOMECAN_HEADER_PRIO_DEFAULT;
 			msg.header.mode = HOMECAN_HEADER_MODE_SRC;
@@ -1485,11 +2928,20 @@ void transmitChannelState(uint8_t ch) {
 			msg.channel = ch;
 			msg.length = 1;
 			msg.data[0] = channelconfig[ch].raffstate.mode==RAFFSTORE_IDLE?0:1;
-			while (!homecan_transmit(&msg)) {
-				_delay_ms(1);
-			}
+			transmitState(&msg);
 			*/
 			break;
+		case FUNCTION_RAFFSTORE_SCHEDULER:
+			msg.header.priority = HOMECAN_HEADER_PRIO_DEFAULT;
+			msg.header.mode = HOMECAN_HEADER_MODE_SRC;
+			msg.msgtype = HOMECAN_MSGTYPE_RAFFSTORE_QUEUE;
+			msg.address = homecan_getDeviceID();
+			msg.channel = ch;
+			msg.length = 2;
+			msg.data[0] = channelconfig[ch].raffschedstate.queued;
+			msg.data[1] = channelconfig[ch].raffschedstate.inrush;
+			transmitState(&msg);
+			break;
 #endif
 #ifdef CONFIG_KEYPAD
 		case FUNCTION_KEYPAD:
@@ -1516,9 +2968,11 @@ void transmitChannelState(uint8_t ch) {
 				msg.length = 2;
 				msg.data[0] = freq&0xFF;
 				msg.data[1] = freq>>8;
-				while (!homecan_transmit(&msg)) {
-					_delay_ms(1);
-				}
+				transmitState(&msg);
+				msg.msgtype = HOMECAN_MSGTYPE_BUZZER_PATTERN;
+				msg.length = 1;
+				msg.data[0] = channelconfig[ch].buzzerstate.pattern;
+				transmitState(&msg);
 			}
 			break;
 #endif
@@ -1532,9 +2986,7 @@ void transmitChannelState(uint8_t ch) {
 			msg.length = sizeof(float);
 			data = (float*)&msg.data[0];
 			*data = channelconfig[ch].kwbtemp.value;
-			while (!homecan_transmit(&msg)) {
-				_delay_ms(1);
-			}
+			transmitState(&msg);
 			break;
 		case FUNCTION_KWB_INPUT:
 			msg.header.priority = HOMECAN_HEADER_PRIO_DEFAULT;
@@ -1544,9 +2996,7 @@ void transmitChannelState(uint8_t ch) {
 			msg.channel = ch;
 			msg.length = 1;
 			msg.data[0] = channelconfig[ch].kwbstate.value;
-			while (!homecan_transmit(&msg)) {
-				_delay_ms(1);
-			}
+			transmitState(&msg);
 			break;
 #ifdef CONFIG_POTIO
 		case FUNCTION_KWB_HK:
@@ -1555,11 +3005,13 @@ void transmitChannelState(uint8_t ch) {
 			msg.msgtype = HOMECAN_MSGTYPE_KWB_HK;
 			msg.address = homecan_getDeviceID();
 			msg.channel = ch;
-			msg.length = 1;
+			msg.length = 5;
 			msg.data[0] = channelconfig[ch].kwbhk.mode;
-			while (!homecan_transmit(&msg)) {
-				_delay_ms(1);
-			}
+			msg.data[1] = channelconfig[ch].kwbhk.position&0xFF;
+			msg.data[2] = channelconfig[ch].kwbhk.position>>8;
+			msg.data[3] = channelconfig[ch].kwbhk.feedback&0xFF;
+			msg.data[4] = channelconfig[ch].kwbhk.feedback>>8;
+			transmitState(&msg);
 			break;
 #endif
 #endif
@@ -1574,9 +3026,7 @@ void transmitChannelState(uint8_t ch) {
 			msg.length = sizeof(float);
 			data = (float*)&msg.data[0];
 			*data = (float)channelconfig[ch].tempstate.value;
-			while (!homecan_transmit(&msg)) {
-				_delay_ms(1);
-			}
+			transmitState(&msg);
 	#endif
 	#ifdef CONFIG_I2C
 			msg.header.priority = HOMECAN_HEADER_PRIO_DEFAULT;
@@ -1587,11 +3037,22 @@ void transmitChannelState(uint8_t ch) {
 			msg.length = sizeof(float);
 			data = (float*)&msg.data[0];
 			*data = (float)channelconfig[ch].tempstate.value;
-			while (!homecan_transmit(&msg)) {
-				_delay_ms(1);
-			}
+			transmitState(&msg);
 	#endif
 			break;
+		case FUNCTION_THERMOSTAT:
+			msg.header.priority = HOMECAN_HEADER_PRIO_DEFAULT;
+			msg.header.mode = HOMECAN_HEADER_MODE_SRC;
+			msg.msgtype = HOMECAN_MSGTYPE_SETPOINT;
+			msg.address = homecan_getDeviceID();
+			msg.channel = ch;
+			msg.length = 4;
+			msg.data[0] = channelconfig[ch].thermostat.setpoint&0xFF;
+			msg.data[1] = channelconfig[ch].thermostat.setpoint>>8;
+			msg.data[2] = channelconfig[ch].thermostat.output;
+			msg.data[3] = channelconfig[ch].thermostat.on;
+			transmitState(&msg);
+			break;
 #endif
 #ifdef CONFIG_ANALOG
 		case FUNCTION_LUMINOSITY:
@@ -1603,9 +3064,7 @@ void transmitChannelState(uint8_t ch) {
 			msg.length = sizeof(float);
 			data = (float*)&msg.data[0];
 			*data = channelconfig[ch].analogstate.value;
-			while (!homecan_transmit(&msg)) {
-				_delay_ms(1);
-			}
+			transmitState(&msg);
 			break;
 		case FUNCTION_HUMIDITY:
 			msg.header.priority = HOMECAN_HEADER_PRIO_DEFAULT;
@@ -1615,9 +3074,7 @@ void transmitChannelState(uint8_t ch) {
 			msg.channel = ch;
 			msg.length = 1;
 			msg.data[0] = channelconfig[ch].humiditystate.value;
-			while (!homecan_transmit(&msg)) {
-				_delay_ms(1);
-			}
+			transmitState(&msg);
 			break;
 #endif
 #ifdef CONFIG_HOMECAN_GATEWAY
@@ -1631,11 +3088,39 @@ void transmitChannelState(uint8_t ch) {
 			data = (float*)&msg.data[0];
 			*data = ((float)channelconfig[ch].busloadstate.byteCount+homecan_getTxByteCount())/channelconfig[ch].busloadstate.intervall;
 			channelconfig[ch].busloadstate.byteCount = 0;
-			while (!homecan_transmit(&msg)) {
-				_delay_ms(1);
-			}
+			transmitState(&msg);
 			break;
 #endif
+		case FUNCTION_SCHEDULER:
+			msg.header.priority = HOMECAN_HEADER_PRIO_DEFAULT;
+			msg.header.mode = HOMECAN_HEADER_MODE_SRC;
+			msg.msgtype = HOMECAN_MSGTYPE_SCHEDULE;
+			msg.address = homecan_getDeviceID();
+			msg.channel = ch;
+			msg.length = 1;
+			msg.data[0] = channelconfig[ch].schedulestate.lastSlot;
+			transmitState(&msg);
+			break;
+		case FUNCTION_CLOCK:
+			{
+				uint32_t seconds;
+				uint8_t ticks;
+				msg.header.priority = HOMECAN_HEADER_PRIO_DEFAULT;
+				msg.header.mode = HOMECAN_HEADER_MODE_SRC;
+				msg.msgtype = HOMECAN_MSGTYPE_TIME;
+				msg.address = homecan_getDeviceID();
+				msg.channel = ch;
+				msg.length = homecan_getTime(&seconds,&ticks)?5:0;
+				msg.data[0] = seconds&0xFF;
+				msg.data[1] = (seconds>>8)&0xFF;
+				msg.data[2] = (seconds>>16)&0xFF;
+				msg.data[3] = seconds>>24;
+				msg.data[4] = ticks;
+				while (!homecan_transmit(&msg)) {
+					_delay_ms(1);
+				}
+			}
+			break;
 
 		}
 		channelconfig[ch].changed = 0;
@@ -1650,6 +3135,19 @@ void channelconfig_100msTask(void) {
 	IRMP_DATA irmp_data;
 #endif
 
+	debuglog_task();
+#ifdef CONFIG_SAMPLER
+	sampler_task();
+#endif
+#ifdef CONFIG_SSR
+	for (ch=0;ch<CHANNELCONFIG_SSR_MAX_DETACHED;ch++) {
+		if (ssrDetached[ch].ssrstate.error) {
+			ssrDetached[ch].ssrstate.error = 0;
+			ssr_reportDetached(ssrDetached[ch].channel);
+		}
+	}
+#endif
+
 	//check all channels if something changed
 	for (ch=0;ch<=CHANNELCONFIG_MAX_CONFIG;ch++) {
 		uint8_t in __attribute__ ((unused));
@@ -1678,9 +3176,37 @@ void channelconfig_100msTask(void) {
 #ifdef CONFIG_MOTION
 		case FUNCTION_MOTION:
 			in = channelconfig_getPort(channelconfig[ch].port[0]);
-			if (channelconfig[ch].state != in) {
-				channelconfig[ch].state = in;
-				channelconfig[ch].changed = 1;
+			if (in && !channelconfig[ch].motionstate.raw) {
+				channelconfig[ch].motionstate.events++;
+			}
+			channelconfig[ch].motionstate.raw = in;
+			if (channelconfig[ch].motionstate.hold==0) {
+				//no hold time, report raw level
+				if (channelconfig[ch].state != in) {
+					channelconfig[ch].state = in;
+					channelconfig[ch].changed = 1;
+				}
+				break;
+			}
+			if (channelconfig[ch].motionstate.offTimer>0) {
+				channelconfig[ch].motionstate.offTimer--;
+			}
+			if (in) {
+				//retrigger hold time
+				channelconfig[ch].motionstate.holdTimer = channelconfig[ch].motionstate.hold>6553?0xFFFF:channelconfig[ch].motionstate.hold*10;
+				if (!channelconfig[ch].motionstate.value && channelconfig[ch].motionstate.offTimer==0) {
+					channelconfig[ch].motionstate.value = 1;
+					channelconfig[ch].changed = 1;
+				}
+			} else if (channelconfig[ch].motionstate.value) {
+				if (channelconfig[ch].motionstate.holdTimer>0) {
+					channelconfig[ch].motionstate.holdTimer--;
+				}
+				if (channelconfig[ch].motionstate.holdTimer==0) {
+					channelconfig[ch].motionstate.value = 0;
+					channelconfig[ch].motionstate.offTimer = channelconfig[ch].motionstate.minOff*10;
+					channelconfig[ch].changed = 1;
+				}
 			}
 			break;
 #endif
@@ -1733,6 +3259,8 @@ void channelconfig_100msTask(void) {
 #endif
 #ifdef CONFIG_TEMP
 		case FUNCTION_TEMPSENS:
+		case FUNCTION_THERMOSTAT:
+			//slow, handled in 1s task
 			break;
 #endif
 #ifdef CONFIG_KEYPAD
@@ -1742,6 +3270,13 @@ void channelconfig_100msTask(void) {
 #endif
 #ifdef CONFIG_RAFFSTORE
 		case FUNCTION_RAFFSTORE:
+			//motor handled inside 10ms ISR, model bookkeeping after a stop here
+			if (raffRuntime[channelconfig[ch].raffstate.slot].moveDone) {
+				raffRuntime[channelconfig[ch].raffstate.slot].moveDone = 0;
+				raffstore_moveDone(ch);
+			}
+			break;
+		case FUNCTION_RAFFSTORE_SCHEDULER:
 			//handled inside 10ms ISR
 			break;
 #endif
@@ -1772,6 +3307,11 @@ void channelconfig_100msTask(void) {
 #endif
 #ifdef CONFIG_BUZZER
 		case FUNCTION_BUZZER:
+			//report pattern start and end
+			if (channelconfig[ch].buzzerstate.pattern!=buzzerPattern) {
+				channelconfig[ch].buzzerstate.pattern = buzzerPattern;
+				channelconfig[ch].changed = 1;
+			}
 			break;
 #endif
 #ifdef CONFIG_KWB
@@ -1790,6 +3330,9 @@ void channelconfig_100msTask(void) {
 			//slow, handled in 1s task
 			break;
 #endif
+		case FUNCTION_CLOCK:
+		case FUNCTION_SCHEDULER:
+			break;
 		}
 		transmitChannelState(ch);
 	}
@@ -1797,6 +3340,9 @@ void channelconfig_100msTask(void) {
 
 void channelconfig_task() {
 	channelconfig_receiveTask();
+#ifdef CONFIG_POTIO
+	mcp4651_poll();
+#endif
 	if (timer100ms) {
 		timer100ms = 0;
 		channelconfig_setStatusLED(1,1);
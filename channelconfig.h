@@ -20,6 +20,7 @@ typedef enum function_t {
 #endif
 #ifdef CONFIG_RAFFSTORE
 	FUNCTION_RAFFSTORE = 3,
+	FUNCTION_RAFFSTORE_SCHEDULER = 23,
 #endif
 #ifdef CONFIG_SSR
 	FUNCTION_SSR = 4,
@@ -32,6 +33,7 @@ typedef enum function_t {
 #endif
 #ifdef CONFIG_TEMP
 	FUNCTION_TEMPSENS = 7,
+	FUNCTION_THERMOSTAT = 26,
 #endif
 #ifdef CONFIG_LED
 	FUNCTION_LED = 8,
@@ -61,6 +63,8 @@ typedef enum function_t {
 #ifdef CONFIG_HOMECAN_GATEWAY
 	FUNCTION_BUSLOAD = 20,
 #endif
+	FUNCTION_CLOCK = 24,
+	FUNCTION_SCHEDULER = 25,
 	FUNCTION_RESERVED = 255
 } function_t;
 
@@ -105,6 +109,14 @@ typedef enum raffmode_t {
 	RAFFSTORE_MOVE = 3
 } raffmode_t;
 
+typedef enum raffcalib_t {
+	RAFFSTORE_CALIB_NONE = 0,
+	RAFFSTORE_CALIB_RESYNC = 1,			//drive to nearest end stop, then back to the old target
+	RAFFSTORE_CALIB_MEASURE_TOP = 2,	//drive to upper end stop before measuring
+	RAFFSTORE_CALIB_MEASURE_DOWN = 3,	//measure travel time down until marked by STOPMOVE, else ends after the expected travel plus margin
+	RAFFSTORE_CALIB_MEASURE_UP = 4		//measure travel time up until marked by STOPMOVE, else ends after the expected travel plus margin
+} raffcalib_t;
+
 #define CHANNELCONFIG_RAFFSTORE_ANGLE_MAX		12750	//0.5s*100*255
 #define CHANNELCONFIG_RAFFSTORE_POSITION_MAX	510000	//20s*100*255
 
@@ -122,23 +134,106 @@ typedef struct
 	uint32_t positionTarget;	//0(offen)-CHANNELCONFIG_RAFFSTORE_POSITION_MAX(zu)
 	uint8_t positionUp;			//delta position in 10ms
 	uint8_t positionDown;		//delta position in 10ms
+
+	uint8_t reportDelta;	//minimal change of position or angle (0-255) for a report while moving
+	uint8_t slot;			//entry in the motor runtime table, assigned by channelconfig
 } raffstate_t;
+
+typedef struct
+{
+	uint8_t maxStarts;		//motors allowed inside their start window at the same time
+	uint8_t stagger;		//start window in 10ms
+	uint8_t queued;			//moves waiting for a start slot
+	uint8_t inrush;			//motors inside their start window
+} raffschedstate_t;
+#endif
+
+#ifdef CONFIG_SSR
+typedef enum ssrphase_t {
+	SSR_PHASE_IDLE = 0,
+	SSR_PHASE_CHECK = 1,	//compare feedback with target, pulse again if needed
+	SSR_PHASE_PULSE = 2,	//port[0] pulsed
+	SSR_PHASE_SETTLE = 3	//wait for feedback after pulse
+} ssrphase_t;
+
+typedef struct
+{
+	uint8_t value;		//feedback port[1], has to stay first member (state)
+	uint8_t target;
+	ssrphase_t phase;
+	uint8_t timer;		//remaining 10ms ticks of the current phase
+	uint8_t retry;
+	uint8_t error;		//1 if switching failed, reported once
+} ssrstate_t;
 #endif
 
 #ifdef CONFIG_BUZZER
+typedef enum {
+	BUZZER_PATTERN_ERROR = 0,
+	BUZZER_PATTERN_ACK = 1,
+	BUZZER_PATTERN_DOORCHIME = 2,
+	BUZZER_PATTERN_ALARM = 3,
+	BUZZER_PATTERN_CONFIRM = 4,
+	BUZZER_PATTERN_COUNT,
+	BUZZER_PATTERN_NONE = 0xFF
+} buzzerpattern_t;
+
 typedef struct
 {
 	uint16_t freq;
+	uint8_t pattern;		//last reported pattern
 } buzzerstate_t;
 #endif
 
+#ifdef CONFIG_MOTION
+typedef struct
+{
+	uint8_t value;			//occupancy, has to stay first member (state)
+	uint8_t raw;			//last sampled PIR level
+	uint16_t hold;			//s, occupancy is held after the last detection, 0 reports raw level
+	uint8_t minOff;			//s, minimum time unoccupied before a new occupancy is reported
+	uint8_t countIntervall;	//10s, period of activity count reports, 0 off
+	uint16_t holdTimer;		//100ms
+	uint16_t offTimer;		//100ms
+	uint16_t countTimer;	//s
+	uint16_t events;		//rising PIR edges since last count report
+	uint8_t countReport;	//1 if events have to be reset after sending
+} motionstate_t;
+#endif
+
 #ifdef CONFIG_TEMP
 typedef struct
 {
 	float value;
 	uint8_t intervall;
 	uint8_t counter;
+	uint8_t valid;			//1 after the first successful read
+	uint8_t age;			//s since the last successful read, saturates at 255
 } temperature_t;
+
+typedef enum {
+	THERMOSTAT_HYSTERESIS = 0,
+	THERMOSTAT_PID = 1
+} thermostatmode_t;
+
+typedef struct
+{
+	int16_t setpoint;		//0.1°C
+	uint8_t sensor;			//TEMPSENS or KWB_TEMP channel
+	uint8_t actuator;		//OUTPUT, SSR or KWB_HK channel
+	uint8_t mode;			//thermostatmode_t
+	uint8_t hysteresis;		//0.1K, half band around the setpoint
+	uint8_t period;			//10s, cycle of the time-proportioned output
+	uint8_t kp;				//%/K
+	uint8_t ki;				//%/(K*min)
+	uint8_t kd;				//%*min/K
+	int32_t integral;		//0.1K*s
+	int16_t lastError;		//0.1K
+	uint16_t timer;			//s inside the current cycle
+	uint8_t output;			//%
+	uint8_t on:1;			//actuator state
+	uint8_t stale:1;		//sensor stopped updating, actuator is off
+} thermostat_t;
 #endif
 
 #ifdef CONFIG_ELTAKO
@@ -192,14 +287,25 @@ typedef struct
 	uint8_t channel;
 	uint8_t intervall;
 	uint8_t counter;
+	uint8_t valid;			//1 after the first frame from the boiler
+	uint8_t age;			//s since the last frame, saturates at 255
 } kwbtemp_t;
 
 #ifdef CONFIG_POTIO
+#define KWB_HK_MODE_SETPOINT	4		//wiper follows the target, closed loop over the KWB sense value
+#define KWB_HK_MODE_THERMOSTAT	5		//wiper driven by a thermostat channel, setpoint mode is refused
+
 typedef struct
 {
 	uint8_t hk;
 	uint8_t mode;
-	uint16_t position;
+	uint16_t position;		//current wiper
+	int16_t target;			//0.1°C, value the boiler should see
+	int16_t feedback;		//0.1°C, value the boiler reports
+	uint8_t sense;			//index of the feedback in the KWB sense message
+	uint8_t intervall;		//s, minimum time between two wiper steps
+	uint8_t timer;
+	uint8_t fresh;			//1 if feedback arrived since the last step
 } kwbhk_t;
 #endif
 #endif
@@ -213,6 +319,21 @@ typedef struct
 } busload_t;
 #endif
 
+#define CLOCK_FLAG_TIMESTAMP	0x01	//append event timestamps to state frames
+
+typedef struct
+{
+	uint8_t flags;
+	uint8_t ntpip[4];		//gateway only, NTP server on the local network
+	uint16_t timer;			//s since last NTP request
+} clockstate_t;
+
+typedef struct
+{
+	int8_t utcOffset;		//15min, local time used by the schedule table
+	uint8_t lastSlot;		//last executed schedule entry
+} schedulestate_t;
+
 typedef struct
 {
 	function_t function;
@@ -224,16 +345,24 @@ typedef struct
 #endif
 #ifdef CONFIG_RAFFSTORE
 		raffstate_t raffstate;
+		raffschedstate_t raffschedstate;
+#endif
+#ifdef CONFIG_SSR
+		ssrstate_t ssrstate;
 #endif
 #ifdef CONFIG_BUZZER
 		buzzerstate_t buzzerstate;
 #endif
+#ifdef CONFIG_MOTION
+		motionstate_t motionstate;
+#endif
 #ifdef CONFIG_ELTAKO
 		dimmerstate_t dimmerstate;
 		enocean_t enoceanstate;
 #endif
 #ifdef CONFIG_TEMP
 		temperature_t tempstate;
+		thermostat_t thermostat;
 #endif
 #ifdef CONFIG_ANALOG
 		analog_t analogstate;
@@ -249,10 +378,16 @@ typedef struct
 #ifdef CONFIG_HOMECAN_GATEWAY
 		busload_t busloadstate;
 #endif
+		clockstate_t clockstate;
+		schedulestate_t schedulestate;
 	};
 	uint8_t changed;
 } channelconfig_t;
 
+//stored with the config in EEPROM, bump whenever a state struct of the union changes size or order,
+//a config stored with another layout is dropped at init
+#define CHANNELCONFIG_LAYOUT	3
+
 void channelconfig_init(void);
 //iterate all channel, do for each according to configuration
 void channelconfig_task(void);
@@ -263,6 +398,11 @@ uint8_t channelconfig_getChannel(uint8_t port);
 extern void channelconfig_init_device(void);
 extern circuit_t channelconfig_getPortType(uint8_t port);
 extern uint8_t channelconfig_getMaxPort(void);
+#if defined(CONFIG_ELTAKO) || defined(CONFIG_KWB)
+//UART behind an RS485 port, CHANNELCONFIG_NO_UART for any other port
+#define CHANNELCONFIG_NO_UART	0xFF
+extern uint8_t channelconfig_getPortUart(uint8_t port);
+#endif
 extern void channelconfig_setPort(uint8_t port, uint8_t state);
 extern uint8_t channelconfig_getPort(uint8_t port);
 extern void channelconfig_setStatusLED(uint8_t led, uint8_t state);
@@ -272,9 +412,11 @@ extern void channelconfig_1sUserTask(void);
 
 #ifdef CONFIG_KEYPAD
 extern void channelconfig_keyTask(void);
+extern void channelconfig_setKeyCode(uint8_t slot, uint32_t hash, uint8_t address, uint8_t channel, uint8_t msgtype);
 #endif
 #ifdef CONFIG_BUZZER
 extern void channelconfig_setBuzzer(uint16_t freq);
+extern void channelconfig_playBuzzer(uint8_t pattern, uint8_t repeat);
 #endif
 
 #endif /* CHANNELCONFIG_H_ */
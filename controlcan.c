@@ -79,6 +79,16 @@ circuit_t channelconfig_getPortType(uint8_t port) {
 	return portconfig[port].circuit;
 }
 
+#if defined(CONFIG_ELTAKO) || defined(CONFIG_KWB)
+uint8_t channelconfig_getPortUart(uint8_t port) {
+	switch (port) {
+		case 44:
+		case 45: return 1;
+	}
+	return CHANNELCONFIG_NO_UART;
+}
+#endif
+
 void channelconfig_setPort(uint8_t port, uint8_t state) {
 	if (state == 0) {
 		switch (port) {
@@ -0,0 +1,13 @@
+#ifndef CRC16_H_
+#define CRC16_H_
+
+#include <stdint.h>
+
+// CRC-16/XMODEM, X^16+X^12+X^5+X^0, init 0, for EEPROM records and transfers
+uint16_t crc16( const uint8_t *data, uint16_t length );
+// one byte, 512 byte table in flash, fastest
+uint16_t crc16_update( uint16_t crc, uint8_t data );
+// one byte, 32 byte table in flash, two lookups per byte
+uint16_t crc16_update_nibble( uint16_t crc, uint8_t data );
+
+#endif
@@ -7,7 +7,12 @@ extern "C" {
 
 #include <stdint.h>
 
+// Dallas/Maxim CRC8 (1-Wire), X^8+X^5+X^4+X^0, reflected, init 0
 uint8_t crc8( uint8_t* data, uint16_t number_of_bytes_in_data );
+// one byte, 256 byte table in flash, fastest
+uint8_t crc8_update( uint8_t crc, uint8_t data );
+// one byte, 16 byte table in flash, two lookups per byte
+uint8_t crc8_update_nibble( uint8_t crc, uint8_t data );
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,127 @@
+/*
+ * debuglog.c
+ *
+ * Binary log records, sent as HOMECAN_MSGTYPE_STRING frames while somebody listens
+ */
+
+#include <avr/interrupt.h>
+#include <util/delay.h>
+#include <string.h>
+
+#include "global.h"
+#include "homecan.h"
+#include "debuglog.h"
+
+#define DEBUGLOG_RING		16		//records, power of two
+#define DEBUGLOG_PER_TASK	2		//frames per 100ms
+#define DEBUGLOG_MAX_MINUTES	100
+
+typedef struct {
+	uint8_t id;
+	uint8_t seq;
+	uint16_t ticks;
+	uint16_t arg0;
+	uint16_t arg1;
+} debuglog_t;
+
+static debuglog_t ring[DEBUGLOG_RING];
+static volatile uint8_t head = 0;
+static volatile uint8_t count = 0;
+static volatile uint16_t dropped = 0;
+static uint8_t seq = 0;
+static volatile uint16_t subscribed = 0;	//100ms steps left
+
+//10ms ticks from the node clock, runs from power up even without time sync
+static uint16_t debuglog_ticks(void) {
+	uint32_t seconds;
+	uint8_t ticks;
+	homecan_getTime(&seconds,&ticks);
+	return seconds*HOMECAN_TICKS_PER_SECOND+ticks;
+}
+
+void debuglog(debuglog_id_t id, uint16_t arg0, uint16_t arg1) {
+	debuglog_t *rec;
+	uint8_t tmp_sreg = SREG;
+	cli();
+	if (subscribed==0) {
+		//nobody listens, no cost on the bus
+	} else if (count>=DEBUGLOG_RING) {
+		dropped++;
+	} else {
+		rec = &ring[(head+count)&(DEBUGLOG_RING-1)];
+		rec->id = id;
+		rec->seq = seq++;
+		rec->ticks = debuglog_ticks();
+		rec->arg0 = arg0;
+		rec->arg1 = arg1;
+		count++;
+	}
+	SREG = tmp_sreg;
+}
+
+void debuglog_subscribe(uint8_t minutes) {
+	uint8_t tmp_sreg;
+	if (minutes>DEBUGLOG_MAX_MINUTES) minutes = DEBUGLOG_MAX_MINUTES;
+	tmp_sreg = SREG;
+	cli();
+	subscribed = minutes*600;
+	if (subscribed==0) {
+		count = 0;
+		dropped = 0;
+	}
+	SREG = tmp_sreg;
+}
+
+static void debuglog_send(const debuglog_t *rec) {
+	homecan_t msg;
+	msg.address = homecan_getDeviceID();
+	msg.channel = DEBUGLOG_CHANNEL;
+	msg.header.priority = HOMECAN_HEADER_PRIO_DEFAULT;
+	msg.header.mode = HOMECAN_HEADER_MODE_SRC;
+	msg.msgtype = HOMECAN_MSGTYPE_STRING;
+	msg.length = 8;
+	msg.data[0] = rec->id;
+	msg.data[1] = rec->seq;
+	msg.data[2] = rec->ticks&0xFF;
+	msg.data[3] = rec->ticks>>8;
+	msg.data[4] = rec->arg0&0xFF;
+	msg.data[5] = rec->arg0>>8;
+	msg.data[6] = rec->arg1&0xFF;
+	msg.data[7] = rec->arg1>>8;
+	while (!homecan_transmit(&msg)) {
+		_delay_ms(1);
+	}
+}
+
+void debuglog_task(void) {
+	debuglog_t rec;
+	uint8_t n;
+	uint8_t tmp_sreg = SREG;
+	cli();
+	if (subscribed>0) subscribed--;
+	n = (subscribed>0);
+	SREG = tmp_sreg;
+	if (!n) return;
+	for (n=0;n<DEBUGLOG_PER_TASK;n++) {
+		tmp_sreg = SREG;
+		cli();
+		if (count==0 && dropped==0) {
+			SREG = tmp_sreg;
+			break;
+		}
+		if (count==0) {
+			rec.id = LOG_DROPPED;
+			rec.seq = seq++;
+			rec.ticks = debuglog_ticks();
+			rec.arg0 = dropped;
+			rec.arg1 = 0;
+			dropped = 0;
+		} else {
+			memcpy(&rec,&ring[head],sizeof(debuglog_t));
+			head = (head+1)&(DEBUGLOG_RING-1);
+			count--;
+		}
+		SREG = tmp_sreg;
+		debuglog_send(&rec);
+	}
+}
@@ -0,0 +1,32 @@
+/*
+ * debuglog.h
+ *
+ * Binary log records, sent as HOMECAN_MSGTYPE_STRING frames while somebody listens
+ */
+
+#ifndef DEBUGLOG_H_
+#define DEBUGLOG_H_
+
+#include <stdint.h>
+
+//record ids, the host keeps the format strings
+typedef enum {
+	LOG_NET_RECOVERY		= 0x01,	//"enc28j60 health=%02x"
+	LOG_SSR_FEEDBACK		= 0x02,	//"ssr ch=%u requested=%u"
+	LOG_KEYPAD_LOCKED		= 0x03,	//"keypad ch=%u locked for %us"
+	LOG_ONEWIRE_ERROR		= 0x04,	//"1-wire ch=%u error=%u"
+	LOG_DROPPED				= 0xFF	//"%u records lost"
+} debuglog_id_t;
+
+//HOMECAN_MSGTYPE_STRING on this channel carries log records:
+//data[0] id, data[1] sequence, data[2..3] 10ms ticks, data[4..5] arg0, data[6..7] arg1
+#define DEBUGLOG_CHANNEL		0xFF
+
+//constant time, safe in interrupts, drops the record if the ring is full or nobody listens
+void debuglog(debuglog_id_t id, uint16_t arg0, uint16_t arg1);
+//minutes to keep sending, 0 stops
+void debuglog_subscribe(uint8_t minutes);
+//every 100ms, sends a bounded number of records
+void debuglog_task(void);
+
+#endif /* DEBUGLOG_H_ */
@@ -19,6 +19,9 @@
 
 static uint8_t Enc28j60Bank;
 static int16_t gNextPacketPtr;
+static uint16_t gRxErrors=0; // dropped (buffer full) or invalid packets
+static uint8_t gRxCorrupt=0; // next packet pointer or length out of range
+static uint8_t gTxStalled=0; // enc28j60PacketSend gave up waiting
 #define ENC28J60_CONTROL_PORT   PORTB
 #define ENC28J60_CONTROL_DDR    DDRB
 #define ENC28J60_CONTROL_CS PORTB0
@@ -294,14 +297,67 @@ void enc28j60DisableBroadcast( void ) {
 uint8_t enc28j60linkup(void)
 {
         // bit 10 (= bit 3 in upper reg)
-        if (enc28j60PhyReadH(PHSTAT2) && 4){
+        if (enc28j60PhyReadH(PHSTAT2) & 4){
                 return(1);
         }
         return(0);
 }
 
+static void enc28j60ResetTx(void)
+{
+        enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, ECON1, ECON1_TXRST);
+        enc28j60WriteOp(ENC28J60_BIT_FIELD_CLR, ECON1, ECON1_TXRST);
+        enc28j60WriteOp(ENC28J60_BIT_FIELD_CLR, EIR, EIR_TXERIF);
+}
+
+// reset only the receive logic and drop everything buffered
+static void enc28j60ResetRx(void)
+{
+        enc28j60WriteOp(ENC28J60_BIT_FIELD_CLR, ECON1, ECON1_RXEN);
+        enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, ECON1, ECON1_RXRST);
+        enc28j60WriteOp(ENC28J60_BIT_FIELD_CLR, ECON1, ECON1_RXRST);
+        gNextPacketPtr = RXSTART_INIT;
+        enc28j60Write(ERXSTL, RXSTART_INIT&0xFF);
+        enc28j60Write(ERXSTH, RXSTART_INIT>>8);
+        enc28j60Write(ERXRDPTL, RXSTART_INIT&0xFF);
+        enc28j60Write(ERXRDPTH, RXSTART_INIT>>8);
+        enc28j60Write(ERXNDL, RXSTOP_INIT&0xFF);
+        enc28j60Write(ERXNDH, RXSTOP_INIT>>8);
+        while (enc28j60Read(EPKTCNT)){
+                enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, ECON2, ECON2_PKTDEC);
+        }
+        enc28j60WriteOp(ENC28J60_BIT_FIELD_CLR, EIR, EIR_RXERIF);
+        enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, ECON1, ECON1_RXEN);
+        gRxCorrupt=0;
+}
+
+// check the chip, call about once per second from the main loop.
+// Repairs rx/tx logic on its own, returns ENC28J60_HEALTH_ bits
+uint8_t enc28j60CheckHealth(void)
+{
+        uint8_t res=0;
+        // a brown out or glitch resets the chip to defaults
+        if (enc28j60Read(ERXNDL)!=(RXSTOP_INIT&0xFF) || enc28j60Read(ERXNDH)!=(RXSTOP_INIT>>8) || !(enc28j60Read(ECON1) & ECON1_RXEN)){
+                return(ENC28J60_HEALTH_LOST);
+        }
+        if (!enc28j60linkup()){
+                res|=ENC28J60_HEALTH_LINKDOWN;
+        }
+        if (gRxCorrupt){
+                enc28j60ResetRx();
+                res|=ENC28J60_HEALTH_RXRESET;
+        }
+        if (gTxStalled || (enc28j60Read(EIR) & EIR_TXERIF)){
+                enc28j60ResetTx();
+                gTxStalled=0;
+                res|=ENC28J60_HEALTH_TXRESET;
+        }
+        return(res);
+}
+
 void enc28j60PacketSend(uint16_t len, uint8_t* packet)
 {
+        uint16_t timeout=2000; // 20ms, a full frame takes 1.2ms
         // Check no transmit in progress
         while (enc28j60ReadOp(ENC28J60_READ_CTRL_REG, ECON1) & ECON1_TXRTS)
         {
@@ -310,6 +366,13 @@ void enc28j60PacketSend(uint16_t len, uint8_t* packet)
                         enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, ECON1, ECON1_TXRST);
                         enc28j60WriteOp(ENC28J60_BIT_FIELD_CLR, ECON1, ECON1_TXRST);
                 }
+                if (--timeout==0){
+                        // stuck without an error flag, reset and report
+                        enc28j60ResetTx();
+                        gTxStalled=1;
+                        break;
+                }
+                _delay_us(10);
         }
 	// Set the write pointer to start of transmit buffer area
 	enc28j60Write(EWRPTL, TXSTART_INIT&0xFF);
@@ -334,6 +397,12 @@ uint8_t enc28j60hasRxPkt(void)
         return(1);
 }
 
+// number of receive errors since power up
+uint16_t enc28j60getRxErrors(void)
+{
+        return(gRxErrors);
+}
+
 // Gets a packet from the network receive buffer, if one is available.
 // The packet will by headed by an ethernet header.
 //      maxlen  The maximum acceptable length of a retrieved packet.
@@ -343,6 +412,11 @@ uint16_t enc28j60PacketReceive(uint16_t maxlen, uint8_t* packet)
 {
 	uint16_t rxstat;
 	uint16_t len;
+        // count receive buffer overflows, the chip drops packets then
+        if (enc28j60Read(EIR) & EIR_RXERIF){
+                gRxErrors++;
+                enc28j60WriteOp(ENC28J60_BIT_FIELD_CLR, EIR, EIR_RXERIF);
+        }
 	// check if a packet has been received and buffered
 	//if( !(enc28j60Read(EIR) & EIR_PKTIF) )
         // The above does not work. See Rev. B4 Silicon Errata point 6.
@@ -359,6 +433,12 @@ uint16_t enc28j60PacketReceive(uint16_t maxlen, uint8_t* packet)
 	// read the packet length (see datasheet page 43)
 	len  = enc28j60ReadOp(ENC28J60_READ_BUF_MEM, 0);
 	len |= enc28j60ReadOp(ENC28J60_READ_BUF_MEM, 0)<<8;
+        // a corrupt header would walk through garbage, see Rev. B4 Silicon Errata
+        if (gNextPacketPtr<RXSTART_INIT || gNextPacketPtr>RXSTOP_INIT || (gNextPacketPtr&1) || len>MAX_FRAMELEN+4 || len<4){
+                gRxErrors++;
+                gRxCorrupt=1;
+                return(0);
+        }
         len-=4; //remove the CRC count
 	// read the receive status (see datasheet page 43)
 	rxstat  = enc28j60ReadOp(ENC28J60_READ_BUF_MEM, 0);
@@ -372,6 +452,7 @@ uint16_t enc28j60PacketReceive(uint16_t maxlen, uint8_t* packet)
         // need to check this.
         if ((rxstat & 0x80)==0){
                 // invalid
+                gRxErrors++;
                 len=0;
         }else{
                 // copy the packet from the receive buffer
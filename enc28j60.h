@@ -278,6 +278,13 @@ extern uint8_t enc28j60getrev(void);
 extern void enc28j60EnableBroadcast(void);
 extern void enc28j60DisableBroadcast(void);
 extern uint8_t enc28j60linkup(void);
+extern uint16_t enc28j60getRxErrors(void);
+// result bits of enc28j60CheckHealth:
+#define ENC28J60_HEALTH_LINKDOWN 0x01 // no link, nothing to repair
+#define ENC28J60_HEALTH_RXRESET  0x02 // receive buffer was corrupt, rx logic reset
+#define ENC28J60_HEALTH_TXRESET  0x04 // transmission stalled, tx logic reset
+#define ENC28J60_HEALTH_LOST     0x08 // configuration lost, call enc28j60Init again
+extern uint8_t enc28j60CheckHealth(void);
 
 #endif
 //@}
@@ -8,22 +8,31 @@
 #ifndef GLOBAL_H_
 #define GLOBAL_H_
 
+//reported in the heartbeat
+#define FIRMWARE_VERSION	1
+
 #ifdef CONFIG_CONTROLCAN
+#define VARIANT_ID	1
 #define CONFIG_HOMECAN_CAN
 #define CONFIG_INPUT
 #define CONFIG_OUTPUT
 #define CONFIG_RAFFSTORE
 #define CONFIG_ELTAKO
+#define CONFIG_ELTAKO_UARTS	0x02	//bit per UART running an Eltako bus
 #define CONFIG_LED
 #define CONFIG_SSR
 #define CONFIG_TEMP
 #define CONFIG_I2C
+#define CONFIG_SAMPLER
 
 #elif CONFIG_MOTIONCAN
+#define VARIANT_ID	2
 #define CONFIG_HOMECAN_CAN
 #define CONFIG_MOTION
+#define CONFIG_SAMPLER
 
 #elif CONFIG_SENSORCAN
+#define VARIANT_ID	3
 #define CONFIG_HOMECAN_CAN
 #define CONFIG_INPUT
 #define CONFIG_LED
@@ -34,6 +43,7 @@
 #define CONFIG_ANALOG
 
 #elif CONFIG_KEYPADCAN
+#define VARIANT_ID	4
 #define CONFIG_HOMECAN_CAN
 #define CONFIG_INPUT
 #define CONFIG_KEYPAD
@@ -41,13 +51,16 @@
 #define CONFIG_ANALOG
 
 #elif CONFIG_NETWORKCAN
+#define VARIANT_ID	5
 #define CONFIG_HOMECAN_GATEWAY
 #define CONFIG_HOMECAN_UDP
 #define CONFIG_HOMECAN_CAN
 
 #elif CONFIG_KWBLAN
+#define VARIANT_ID	6
 #define CONFIG_HOMECAN_UDP
 #define CONFIG_KWB
+#define CONFIG_KWB_UARTS	0x02	//bit per UART running a KWB bus
 #define CONFIG_INPUT
 #define CONFIG_OUTPUT
 #define CONFIG_TEMP
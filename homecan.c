@@ -9,10 +9,17 @@
 #include <avr/wdt.h>
 #include <avr/interrupt.h>
 #include <avr/eeprom.h>
+#include <avr/pgmspace.h>
 #include <string.h>
+#include <stdlib.h>
 
 #include "global.h"
 #include "homecan.h"
+#include "crc16.h"
+#include "debuglog.h"
+#ifdef CONFIG_SAMPLER
+#include "sampler.h"
+#endif
 
 #ifdef CONFIG_HOMECAN_UDP
 #include "enc28j60.h"
@@ -25,6 +32,9 @@
 
 #ifdef CONFIG_HOMECAN_GATEWAY
 static uint32_t txByteCounter = 0;
+static uint32_t loadByteCounter = 0;
+static uint32_t loadStart = 0;
+static uint8_t loadReported = 0;	//a TIME frame carried the load in the current window
 #endif
 
 static can_t msgtx,msgrx;
@@ -39,6 +49,7 @@ static can_filter_t filter = {
 #endif
 
 #ifdef CONFIG_HOMECAN_UDP
+//last byte of mac and ip is the device id, the defaults are left for an unset id (0 or erased EEPROM)
 static uint8_t mymac[6] = {0x00,0x04,0xA3,0x00,0x00,0x01};
 static uint8_t broadcastmac[6] = {0xFF,0xFF,0xFF,0xFF,0xFF,0xFF};
 
@@ -50,6 +61,114 @@ static uint8_t serverip[4] = {192,168,1,255};
 #define BUFFER_SIZE_TX 250
 static uint8_t rxbuf[BUFFER_SIZE_RX+1];
 static uint8_t txbuf[BUFFER_SIZE_TX+1];
+
+//ENC28J60 health, see homecan_checkNetwork
+static uint16_t netRxResets = 0;
+static uint16_t netTxResets = 0;
+static uint16_t netReinits = 0;
+static uint32_t netDownSeconds = 0;
+static uint32_t netDownStart = 0;
+static uint16_t netLastOutage = 0;	//s
+static uint8_t netDown = 0;
+#endif
+
+#ifdef CONFIG_HOMECAN_GATEWAY
+#define HOMECAN_NTP_PORT_L		0x7B	//local port 0x0A7B
+#define HOMECAN_NTP_ARP_REF		1
+#define HOMECAN_NTP_UNIX_OFFSET	2208988800UL
+#define HOMECAN_NTP_STATE_ARP	0
+#define HOMECAN_NTP_STATE_MAC	1
+static uint8_t ntpip[4];
+static uint8_t ntpmac[6];
+static uint8_t ntpState = HOMECAN_NTP_STATE_ARP;
+#endif
+
+#define HOMECAN_CLOCK_STEP	HOMECAN_TICKS_PER_SECOND	//larger offsets are stepped, smaller ones slewed
+#define HOMECAN_CLOCK_SLEW_DIV	10						//slew one tick every 100ms
+static volatile uint32_t clockSeconds = 0;
+static volatile uint8_t clockTicks = 0;
+static volatile int16_t clockSlew = 0;
+static uint8_t clockSlewDiv = 0;
+static volatile uint8_t clockValid = 0;
+
+static volatile uint32_t uptimeSeconds = 0;
+static uint32_t lastTransmit = 0;
+static volatile uint8_t heartbeatDelay = 0;	//10ms ticks until a requested heartbeat is sent, 0 none
+static uint8_t errorCounter = 0;
+static uint8_t busLoad = 0;
+
+#ifdef CONFIG_HOMECAN_GATEWAY
+typedef struct {
+	uint8_t address;		//0: free
+	uint8_t variant;
+	uint8_t firmware;
+	uint8_t errors;
+	uint8_t lost;
+	uint16_t age;			//s since the last heartbeat
+	uint16_t uptime;		//h, at the last heartbeat
+} homecan_node_t;
+static homecan_node_t nodes[HOMECAN_NODE_DIRECTORY_SIZE];
+
+//token buckets for UDP->CAN, one token per frame, refilled every 10ms
+#define HOMECAN_SHAPER_RATE			2	//frames per 10ms, all sources together
+#define HOMECAN_SHAPER_BURST		40
+#define HOMECAN_SHAPER_RESERVE		10	//left for urgent frames only
+#define HOMECAN_SHAPER_SOURCE_RATE	1	//frames per 10ms and source
+#define HOMECAN_SHAPER_SOURCE_BURST	20
+#define HOMECAN_SHAPER_SOURCES		4
+#define HOMECAN_SHAPER_QUEUE		8
+typedef struct {
+	uint8_t ip;				//last octet, the server is on the local network
+	uint8_t tokens;
+} homecan_source_t;
+static volatile uint8_t shaperTokens = HOMECAN_SHAPER_BURST;
+static volatile homecan_source_t shaperSources[HOMECAN_SHAPER_SOURCES];
+static uint8_t shaperSourceNext = 0;
+static homecan_t shaperQueue[HOMECAN_SHAPER_QUEUE];
+static uint8_t shaperQueueHead = 0;
+static uint8_t shaperQueueCount = 0;
+static uint8_t shaperQueueUrgent = 0;	//urgent frames at the head of the queue
+static uint16_t shaperDrops = 0;
+
+//totals for the metrics page
+static uint32_t framesToUDP = 0;
+static uint32_t framesToCAN = 0;
+static uint32_t dedupDrops = 0;
+static uint32_t shaperDropsTotal = 0;
+
+//signatures of recently bridged frames, suppresses loops over a second gateway
+#define HOMECAN_DEDUP_SIZE		16
+#define HOMECAN_DEDUP_TTL		20	//10ms ticks
+typedef struct {
+	uint16_t signature;
+	uint8_t tick;
+} homecan_seen_t;
+static homecan_seen_t dedupCache[HOMECAN_DEDUP_SIZE];
+static uint8_t dedupNext = 0;
+static volatile uint8_t dedupTicks = 0;
+
+//firmware block buffered for windowed transfer on CAN
+#define HOMECAN_BLOCK_WINDOW	8	//frames in flight
+#define HOMECAN_BLOCK_ACK_TIMEOUT	10	//10ms ticks
+#define HOMECAN_BLOCK_RETRIES	5
+#define HOMECAN_BLOCK_PACE		2	//10ms ticks between multicast windows, nobody acknowledges them
+#define HOMECAN_BLOCK_PAGE_WRITE	5	//10ms ticks after the last multicast window until the nodes wrote the page
+static uint8_t blockBuffer[HOMECAN_BLOCK_SIZE];
+static uint8_t blockAddress = 0;
+static uint8_t blockActive = 0;
+static uint16_t blockNumber;
+static uint16_t blockLength;
+static uint16_t blockCrc;
+static uint8_t blockFrames;		//including the start frame
+static uint8_t blockNext;
+static uint8_t blockAcked;
+static uint8_t blockTick;
+static uint8_t blockRetries;
+static volatile uint8_t blockTicks = 0;
+
+//another gateway on the same network, the lower address forwards CAN->UDP, the higher one UDP->CAN
+static uint8_t peerAddress = 0;
+static uint16_t peerAge = 0;
 #endif
 
 static uint8_t deviceID;
@@ -58,6 +177,42 @@ uint8_t homecan_getDeviceID() {
 	return deviceID;
 }
 
+#ifdef CONFIG_HOMECAN_UDP
+static void homecan_initEthernet(void) {
+	enc28j60Init(mymac);
+
+	// Magjack leds configuration, see enc28j60 datasheet, page 11
+	// LEDB=yellow LEDA=green
+	// 0x476 is PHLCON LEDA=links status, LEDB=receive/transmit
+	enc28j60PhyWrite(PHLCON,0x476);
+}
+
+//watch the ethernet controller, called every second
+void homecan_checkNetwork(void) {
+	uint8_t health = enc28j60CheckHealth();
+	if (health & ENC28J60_HEALTH_LOST) {
+		//chip lost its configuration, set it up again without touching the rest
+		homecan_initEthernet();
+		netReinits++;
+	}
+	if (health & (ENC28J60_HEALTH_LOST|ENC28J60_HEALTH_RXRESET|ENC28J60_HEALTH_TXRESET)) {
+		debuglog(LOG_NET_RECOVERY,health,0);
+	}
+	if (health & ENC28J60_HEALTH_RXRESET) netRxResets++;
+	if (health & ENC28J60_HEALTH_TXRESET) netTxResets++;
+	if (health & (ENC28J60_HEALTH_LINKDOWN|ENC28J60_HEALTH_LOST)) {
+		if (!netDown) {
+			netDown = 1;
+			netDownStart = uptimeSeconds;
+		}
+		netDownSeconds++;
+	} else if (netDown) {
+		netDown = 0;
+		netLastOutage = (uptimeSeconds-netDownStart>0xFFFF)?0xFFFF:uptimeSeconds-netDownStart;
+	}
+}
+#endif
+
 void homecan_init(uint8_t address) {
 	wdt_disable();
 #ifdef CONFIG_HOMECAN_CAN
@@ -81,15 +236,19 @@ void homecan_init(uint8_t address) {
 #endif
 	can_set_filter(0, &filter);
 	can_set_filter(1, &filter);
+#ifndef CONFIG_HOMECAN_GATEWAY
+	//broadcasts (heartbeat, time) from the gateway
+	filter.id = ((uint32_t)HOMECAN_ADDRESS_BROADCAST)<<8;
+#endif
 	can_set_filter(2, &filter);
 #endif
 #ifdef CONFIG_HOMECAN_UDP
-	enc28j60Init(mymac);
-
-	// Magjack leds configuration, see enc28j60 datasheet, page 11
-	// LEDB=yellow LEDA=green
-	// 0x476 is PHLCON LEDA=links status, LEDB=receive/transmit
-	enc28j60PhyWrite(PHLCON,0x476);
+	if (deviceID!=HOMECAN_ADDRESS_BROADCAST && deviceID!=0xFF) {
+		//several gateways on one network need their own addresses
+		mymac[5] = deviceID;
+		myip[3] = deviceID;
+	}
+	homecan_initEthernet();
 
 	//init the ethernet/ip layer:
 	init_udp_or_www_server(mymac,myip);
@@ -110,6 +269,9 @@ bool homecan_transmitCAN(const homecan_t *msg) {
 	msgtx.length = msg->length;
 	memcpy(&(msgtx.data[0]),&(msg->data[0]),msg->length);
 	can_send_message(&msgtx);
+#ifdef CONFIG_HOMECAN_GATEWAY
+	loadByteCounter += msg->length+8;
+#endif
 	return true;
 }
 #endif
@@ -145,6 +307,9 @@ bool homecan_receiveCAN(homecan_t *msg) {
 		msg->channel = msgrx.id&0xFF;
 		msg->length = msgrx.length;
 		memcpy(&msg->data[0],&msgrx.data[0],msgrx.length);
+#ifdef CONFIG_HOMECAN_GATEWAY
+		loadByteCounter += msg->length+8;
+#endif
 		return true;
 	} else {
 		return false;
@@ -174,12 +339,218 @@ void extractBootloaderMsg(homecan_t *msg,uint8_t* packet,uint8_t payloadlen) {
 	 memcpy(&msg->data[0],&(packet[0]),payloadlen);
 }
 
+#ifdef CONFIG_HOMECAN_GATEWAY
+static void homecan_blockResult(uint8_t address, uint16_t number, uint8_t status) {
+	homecan_t msg;
+	msg.header.priority = HOMECAN_HEADER_PRIO_DEFAULT;
+	msg.header.mode = HOMECAN_HEADER_MODE_SRC;
+	msg.msgtype = HOMECAN_MSGTYPE_BOOTLOADER;
+	msg.address = address;
+	msg.channel = 0;
+	msg.length = 5;
+	msg.data[0] = address;
+	msg.data[1] = HOMECAN_BOOTLOADER_BLOCK;
+	msg.data[2] = number&0xFF;
+	msg.data[3] = number>>8;
+	msg.data[4] = status;
+	homecan_transmitUDP(&msg);
+}
+
+//take a block datagram from the host, streamed by homecan_blockStep
+static void homecan_blockStart(const uint8_t *packet, uint16_t len) {
+	uint16_t number = packet[2] | ((uint16_t)packet[3])<<8;
+	if (blockActive) {
+		homecan_blockResult(packet[0],number,HOMECAN_BLOCK_BUSY);
+		return;
+	}
+	len -= 4;
+	if (len>HOMECAN_BLOCK_SIZE) {
+		//never write a part of the page
+		homecan_blockResult(packet[0],number,HOMECAN_BLOCK_FAILED);
+		return;
+	}
+	memcpy(blockBuffer,&packet[4],len);
+	blockAddress = packet[0];
+	blockNumber = number;
+	blockLength = len;
+	blockCrc = crc16(blockBuffer,len);
+	blockFrames = 1+(len+HOMECAN_BLOCK_PAYLOAD-1)/HOMECAN_BLOCK_PAYLOAD;
+	blockNext = 0;
+	blockAcked = 0;
+	blockRetries = 0;
+	blockTick = blockTicks;
+	blockActive = 1;
+}
+
+//send the frames inside the window, restart from the last ack on timeout
+static void homecan_blockStep(void) {
+	homecan_t msg;
+	uint16_t offset;
+	uint8_t n;
+	if (!blockActive) return;
+	if (blockAddress==HOMECAN_ADDRESS_BROADCAST && blockNext<blockFrames && blockAcked<blockNext
+			&& (uint8_t)(blockTicks-blockTick)>=HOMECAN_BLOCK_PACE) {
+		//multicast windows are released by time
+		blockAcked = blockNext;
+		blockTick = blockTicks;
+	}
+	while (blockNext<blockFrames && blockNext<blockAcked+HOMECAN_BLOCK_WINDOW) {
+		msg.header.priority = HOMECAN_HEADER_PRIO_DEFAULT;
+		msg.header.mode = HOMECAN_HEADER_MODE_DST;
+		msg.msgtype = HOMECAN_MSGTYPE_BOOTLOADER;
+		msg.address = blockAddress;
+		msg.channel = 0;
+		msg.length = 8;
+		msg.data[0] = blockAddress;
+		if (blockNext==0) {
+			msg.data[1] = HOMECAN_BOOTLOADER_BLOCK;
+			msg.data[2] = blockNumber&0xFF;
+			msg.data[3] = blockNumber>>8;
+			msg.data[4] = blockLength&0xFF;
+			msg.data[5] = blockLength>>8;
+			msg.data[6] = blockCrc&0xFF;
+			msg.data[7] = blockCrc>>8;
+		} else {
+			msg.data[1] = blockNext;
+			offset = (blockNext-1)*HOMECAN_BLOCK_PAYLOAD;
+			n = (blockLength-offset<HOMECAN_BLOCK_PAYLOAD)?blockLength-offset:HOMECAN_BLOCK_PAYLOAD;
+			memcpy(&msg.data[2],&blockBuffer[offset],n);
+			msg.length = 2+n;
+		}
+		while (!homecan_transmitCAN(&msg)) {
+			_delay_ms(1);
+		}
+		blockNext++;
+	}
+	if (blockAddress==HOMECAN_ADDRESS_BROADCAST) {
+		//nobody acknowledges a multicast block, missing ones are reported at the end of the session
+		if (blockNext>=blockFrames && (uint8_t)(blockTicks-blockTick)>=HOMECAN_BLOCK_PAGE_WRITE) {
+			blockActive = 0;
+			homecan_blockResult(blockAddress,blockNumber,HOMECAN_BLOCK_WRITTEN);
+		}
+	} else if ((uint8_t)(blockTicks-blockTick)>HOMECAN_BLOCK_ACK_TIMEOUT) {
+		if (++blockRetries>HOMECAN_BLOCK_RETRIES) {
+			blockActive = 0;
+			homecan_blockResult(blockAddress,blockNumber,HOMECAN_BLOCK_TIMEOUT);
+		} else {
+			blockNext = blockAcked;
+			blockTick = blockTicks;
+		}
+	}
+}
+
+//acknowledge from the node for the current block, not forwarded to the host
+static bool homecan_blockAck(const homecan_t *msg) {
+	if (!blockActive || msg->msgtype!=HOMECAN_MSGTYPE_BOOTLOADER || msg->length<4
+			|| msg->data[0]!=blockAddress || msg->data[1]!=HOMECAN_BOOTLOADER_ACK) {
+		return false;
+	}
+	if (msg->data[2]>blockAcked && msg->data[2]<=blockFrames) {
+		blockAcked = msg->data[2];
+		blockTick = blockTicks;
+		blockRetries = 0;
+	}
+	if (msg->data[3]!=HOMECAN_BLOCK_RECEIVING) {
+		blockActive = 0;
+		homecan_blockResult(blockAddress,blockNumber,msg->data[3]);
+	}
+	return true;
+}
+
+//the reply is one segment, its data starts behind a TCP header without options
+#define HOMECAN_HTTP_DATA_P		(TCP_CHECKSUM_L_P+3)
+#define HOMECAN_HTTP_MSS		1460	//ethernet
+#define HOMECAN_HTTP_ROOM		((BUFFER_SIZE_RX+1-HOMECAN_HTTP_DATA_P)<HOMECAN_HTTP_MSS?(BUFFER_SIZE_RX+1-HOMECAN_HTTP_DATA_P):HOMECAN_HTTP_MSS)
+#define HOMECAN_HTTP_NODE_LINE	43		//homecan_node_age_seconds{node="255"} 65535\n
+#define HOMECAN_HTTP_TRUNCATED	"# truncated\n"
+
+static uint16_t homecan_metric(uint16_t pos, const prog_char *name, uint32_t value) {
+	char number[11];
+	pos = fill_tcp_data_p(rxbuf,pos,name);
+	ultoa(value,number,10);
+	pos = fill_tcp_data(rxbuf,pos,number);
+	return fill_tcp_data_p(rxbuf,pos,PSTR("\n"));
+}
+
+//plain text metrics page, answered in one segment
+static void homecan_serveMetrics(uint16_t dat_p) {
+	uint16_t pos;
+	uint8_t i;
+	char number[4];
+	can_error_register_t errors;
+	if (strncmp("GET ",(char *)&rxbuf[dat_p],4)!=0) {
+		pos = fill_tcp_data_p(rxbuf,0,PSTR("HTTP/1.0 501 Not Implemented\r\n\r\n"));
+		www_server_reply(rxbuf,pos);
+		return;
+	}
+	errors = can_read_error_register();
+	pos = fill_tcp_data_p(rxbuf,0,PSTR("HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\n\r\n"));
+	pos = homecan_metric(pos,PSTR("homecan_uptime_seconds "),uptimeSeconds);
+	pos = homecan_metric(pos,PSTR("homecan_frames_total{dir=\"can_to_udp\"} "),framesToUDP);
+	pos = homecan_metric(pos,PSTR("homecan_frames_total{dir=\"udp_to_can\"} "),framesToCAN);
+	pos = homecan_metric(pos,PSTR("homecan_duplicates_total "),dedupDrops);
+	pos = homecan_metric(pos,PSTR("homecan_shaper_queue "),shaperQueueCount);
+	pos = homecan_metric(pos,PSTR("homecan_shaper_drops_total "),shaperDropsTotal);
+	pos = homecan_metric(pos,PSTR("homecan_busload_percent "),busLoad);
+	pos = homecan_metric(pos,PSTR("homecan_can_tx_errors "),errors.tx);
+	pos = homecan_metric(pos,PSTR("homecan_can_rx_errors "),errors.rx);
+	pos = homecan_metric(pos,PSTR("homecan_enc28j60_rx_errors_total "),enc28j60getRxErrors());
+	pos = homecan_metric(pos,PSTR("homecan_enc28j60_recoveries_total{kind=\"rx\"} "),netRxResets);
+	pos = homecan_metric(pos,PSTR("homecan_enc28j60_recoveries_total{kind=\"tx\"} "),netTxResets);
+	pos = homecan_metric(pos,PSTR("homecan_enc28j60_recoveries_total{kind=\"init\"} "),netReinits);
+	pos = homecan_metric(pos,PSTR("homecan_enc28j60_down_seconds_total "),netDownSeconds);
+	pos = homecan_metric(pos,PSTR("homecan_enc28j60_last_outage_seconds "),netLastOutage);
+	pos = homecan_metric(pos,PSTR("homecan_peer_gateway "),peerAddress);
+	for (i=0;i<HOMECAN_NODE_DIRECTORY_SIZE;i++) {
+		if (nodes[i].address==0) continue;
+		if (pos+HOMECAN_HTTP_NODE_LINE+sizeof(HOMECAN_HTTP_TRUNCATED)-1>HOMECAN_HTTP_ROOM) {
+			pos = fill_tcp_data_p(rxbuf,pos,PSTR(HOMECAN_HTTP_TRUNCATED));
+			break;
+		}
+		pos = fill_tcp_data_p(rxbuf,pos,PSTR("homecan_node_age_seconds{node=\""));
+		utoa(nodes[i].address,number,10);
+		pos = fill_tcp_data(rxbuf,pos,number);
+		pos = homecan_metric(pos,PSTR("\"} "),nodes[i].age);
+	}
+	www_server_reply(rxbuf,pos);
+}
+#endif
+
 bool homecan_receiveUDP(homecan_t *msg) {
 	uint16_t plen;
+#ifdef CONFIG_HOMECAN_GATEWAY
+	uint16_t dat_p;
+#endif
 	plen = enc28j60PacketReceive(BUFFER_SIZE_RX, rxbuf);
+#ifdef CONFIG_HOMECAN_GATEWAY
+	dat_p = packetloop_arp_icmp_tcp(rxbuf,plen);
+	if (dat_p!=0) {
+		homecan_serveMetrics(dat_p);
+		return false;
+	}
+#else
 	packetloop_arp_icmp_tcp(rxbuf,plen);
+#endif
 	if (plen!=0) {
 		if (rxbuf[IP_PROTO_P]==IP_PROTO_UDP_V){
+#ifdef CONFIG_HOMECAN_GATEWAY
+			uint32_t ntptime;
+			if (client_ntp_process_answer(rxbuf,&ntptime,HOMECAN_NTP_PORT_L)) {
+				//first byte of the fraction of the transmit timestamp
+				homecan_setTime(ntptime-HOMECAN_NTP_UNIX_OFFSET,(((uint16_t)rxbuf[0x56])*HOMECAN_TICKS_PER_SECOND)>>8);
+				homecan_transmitTime();
+				return false;
+			}
+#endif
+#ifdef CONFIG_HOMECAN_GATEWAY
+			uint16_t udplen = (((uint16_t)rxbuf[UDP_LEN_H_P])<<8 | rxbuf[UDP_LEN_L_P])-UDP_HEADER_LEN;
+			if (rxbuf[UDP_DST_PORT_H_P]==HOMECAN_UDP_PORT_BOOTLOADER>>8 && rxbuf[UDP_DST_PORT_L_P]==(HOMECAN_UDP_PORT_BOOTLOADER&0xFF)
+					&& udplen>8 && rxbuf[UDP_DATA_P+1]==HOMECAN_BOOTLOADER_BLOCK) {
+				//whole flash page, buffered here and streamed on CAN
+				homecan_blockStart(&rxbuf[UDP_DATA_P],udplen);
+				return false;
+			}
+#endif
 			if (rxbuf[UDP_DST_PORT_H_P]==HOMECAN_UDP_PORT_BOOTLOADER>>8 && rxbuf[UDP_DST_PORT_L_P]==(HOMECAN_UDP_PORT_BOOTLOADER&0xFF) && rxbuf[UDP_LEN_L_P]-UDP_HEADER_LEN==8) {
 				//BOOTLOADER port
 				extractBootloaderMsg(msg,&rxbuf[UDP_DATA_P],rxbuf[UDP_LEN_L_P]-UDP_HEADER_LEN);
@@ -196,21 +567,453 @@ bool homecan_receiveUDP(homecan_t *msg) {
 #endif
 
 bool homecan_transmit(const homecan_t *msg) {
+	bool sent = false;
+	if (msg->address==deviceID && msg->header.mode==HOMECAN_HEADER_MODE_SRC) {
+		//own state frames prove liveness as well as a heartbeat
+		uint8_t tmp_sreg = SREG;
+		cli();
+		lastTransmit = uptimeSeconds;
+		SREG = tmp_sreg;
+	}
 	//priority is sending per UDP, Gateways, can only send per UDP by this function
 #ifdef CONFIG_HOMECAN_UDP
-	return homecan_transmitUDP(msg);
+	sent = homecan_transmitUDP(msg);
 #else
 #ifdef CONFIG_HOMECAN_CAN
 #ifdef CONFIG_HOMECAN_GATEWAY
 	txByteCounter+=msg->length+8;
 #endif
-	return homecan_transmitCAN(msg);
+	sent = homecan_transmitCAN(msg);
 #endif
 #endif
+	//callers retry until sent, count each error once
+	if (sent && msg->msgtype==HOMECAN_MSGTYPE_ERROR && errorCounter<0xFF) errorCounter++;
+	return sent;
+}
+
+#ifdef CONFIG_HOMECAN_GATEWAY
+static void homecan_shaperRefill(void) {
+	uint8_t i;
+	if (shaperTokens<=HOMECAN_SHAPER_BURST-HOMECAN_SHAPER_RATE) shaperTokens += HOMECAN_SHAPER_RATE;
+	else shaperTokens = HOMECAN_SHAPER_BURST;
+	for (i=0;i<HOMECAN_SHAPER_SOURCES;i++) {
+		if (shaperSources[i].tokens<=HOMECAN_SHAPER_SOURCE_BURST-HOMECAN_SHAPER_SOURCE_RATE) shaperSources[i].tokens += HOMECAN_SHAPER_SOURCE_RATE;
+		else shaperSources[i].tokens = HOMECAN_SHAPER_SOURCE_BURST;
+	}
+}
+
+//urgent frames may use the reserve and go ahead of the queued ones
+static bool homecan_isUrgent(const homecan_t *msg) {
+	if ((msg->header.priority&0xF)<HOMECAN_HEADER_PRIO_DEFAULT) return true;
+	switch (msg->msgtype) {
+	case HOMECAN_MSGTYPE_ONOFF:
+	case HOMECAN_MSGTYPE_STOPMOVE:
+	case HOMECAN_MSGTYPE_CALL_BOOTLOADER:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool homecan_takeToken(uint8_t reserve) {
+	bool res = false;
+	uint8_t tmp_sreg = SREG;
+	cli();
+	if (shaperTokens>reserve) {
+		shaperTokens--;
+		res = true;
+	}
+	SREG = tmp_sreg;
+	return res;
+}
+
+//send queued frames while the global bucket allows, urgent ones may use the reserve
+static void homecan_shaperDrain(void) {
+	while (shaperQueueCount>0 && homecan_takeToken(shaperQueueUrgent>0?0:HOMECAN_SHAPER_RESERVE)) {
+		while (!homecan_transmitCAN(&shaperQueue[shaperQueueHead])) {
+			_delay_ms(1);
+		}
+		framesToCAN++;
+		shaperQueueHead = (shaperQueueHead+1)%HOMECAN_SHAPER_QUEUE;
+		shaperQueueCount--;
+		if (shaperQueueUrgent>0) shaperQueueUrgent--;
+	}
+}
+
+//queue an urgent frame behind the urgent ones already waiting, a full queue gives up its newest normal frame
+static bool homecan_shaperQueueUrgent(const homecan_t *msg) {
+	uint8_t i;
+	if (shaperQueueUrgent==HOMECAN_SHAPER_QUEUE) return false;
+	if (shaperQueueCount==HOMECAN_SHAPER_QUEUE) {
+		shaperQueueCount--;
+		shaperDrops++;
+		shaperDropsTotal++;
+	}
+	for (i=shaperQueueCount;i>shaperQueueUrgent;i--) {
+		memcpy(&shaperQueue[(shaperQueueHead+i)%HOMECAN_SHAPER_QUEUE],&shaperQueue[(shaperQueueHead+i-1)%HOMECAN_SHAPER_QUEUE],sizeof(homecan_t));
+	}
+	memcpy(&shaperQueue[(shaperQueueHead+shaperQueueUrgent)%HOMECAN_SHAPER_QUEUE],msg,sizeof(homecan_t));
+	shaperQueueCount++;
+	shaperQueueUrgent++;
+	return true;
+}
+
+//forward a frame received per UDP to CAN, limited per source and in total
+static void homecan_shaperForward(const homecan_t *msg, uint8_t ip) {
+	uint8_t i;
+	bool pass = false;
+	bool urgent = homecan_isUrgent(msg);
+	uint8_t tmp_sreg = SREG;
+	cli();
+	for (i=0;i<HOMECAN_SHAPER_SOURCES;i++) {
+		if (shaperSources[i].ip==ip) break;
+	}
+	if (i==HOMECAN_SHAPER_SOURCES) {
+		//new source replaces the oldest one
+		i = shaperSourceNext;
+		shaperSourceNext = (shaperSourceNext+1)%HOMECAN_SHAPER_SOURCES;
+		shaperSources[i].ip = ip;
+		shaperSources[i].tokens = HOMECAN_SHAPER_SOURCE_BURST;
+	}
+	pass = shaperSources[i].tokens>0;
+	SREG = tmp_sreg;
+	if (pass) {
+		if ((urgent || shaperQueueCount==0) && homecan_takeToken(urgent?0:HOMECAN_SHAPER_RESERVE)) {
+			while (!homecan_transmitCAN(msg)) {
+				_delay_ms(1);
+			}
+			framesToCAN++;
+		} else if (urgent) {
+			pass = homecan_shaperQueueUrgent(msg);
+		} else if (shaperQueueCount<HOMECAN_SHAPER_QUEUE) {
+			memcpy(&shaperQueue[(shaperQueueHead+shaperQueueCount)%HOMECAN_SHAPER_QUEUE],msg,sizeof(homecan_t));
+			shaperQueueCount++;
+		} else {
+			pass = false;
+		}
+	}
+	if (!pass) {
+		//source is flooding or the queue is full
+		shaperDrops++;
+		shaperDropsTotal++;
+		return;
+	}
+	//only frames sent or queued count against their source
+	tmp_sreg = SREG;
+	cli();
+	if (shaperSources[i].tokens>0) shaperSources[i].tokens--;
+	SREG = tmp_sreg;
+}
+#endif
+
+#ifdef CONFIG_HOMECAN_GATEWAY
+//returns true if the same frame passed within the last HOMECAN_DEDUP_TTL ticks, remembers it otherwise
+static bool homecan_isDuplicate(const homecan_t *msg) {
+	uint32_t hash = 2166136261UL;
+	uint16_t signature;
+	uint8_t i;
+	//loops need a second gateway, a single one passes identical repeats
+	if (peerAddress==0) return false;
+	//bootloader retries repeat frames on purpose
+	if (msg->msgtype==HOMECAN_MSGTYPE_BOOTLOADER || msg->msgtype==HOMECAN_MSGTYPE_CALL_BOOTLOADER) return false;
+	hash = (hash ^ msg->msgtype) * 16777619UL;
+	hash = (hash ^ msg->address) * 16777619UL;
+	hash = (hash ^ msg->channel) * 16777619UL;
+	hash = (hash ^ (msg->header.mode | msg->length<<1)) * 16777619UL;
+	for (i=0;i<msg->length;i++) {
+		hash = (hash ^ msg->data[i]) * 16777619UL;
+	}
+	signature = (hash>>16) ^ (hash&0xFFFF);
+	for (i=0;i<HOMECAN_DEDUP_SIZE;i++) {
+		if (dedupCache[i].signature==signature && (uint8_t)(dedupTicks-dedupCache[i].tick)<=HOMECAN_DEDUP_TTL) {
+			return true;
+		}
+	}
+	dedupCache[dedupNext].signature = signature;
+	dedupCache[dedupNext].tick = dedupTicks;
+	dedupNext = (dedupNext+1)%HOMECAN_DEDUP_SIZE;
 	return false;
 }
 
+static bool homecan_forwardsToUDP(void) {
+	return peerAddress==0 || deviceID<peerAddress;
+}
+
+static bool homecan_forwardsToCAN(void) {
+	return peerAddress==0 || deviceID>peerAddress;
+}
+#endif
+
+//local clock, called every 10ms from the timer interrupt
+void homecan_tick(void) {
+	uint8_t step = 1;
 #ifdef CONFIG_HOMECAN_GATEWAY
+	homecan_shaperRefill();
+	dedupTicks++;
+	blockTicks++;
+#endif
+	if (clockSlew!=0 && ++clockSlewDiv>=HOMECAN_CLOCK_SLEW_DIV) {
+		clockSlewDiv = 0;
+		if (clockSlew>0) {
+			step = 2;
+			clockSlew--;
+		} else {
+			step = 0;
+			clockSlew++;
+		}
+	}
+	if (heartbeatDelay>1) heartbeatDelay--;
+	clockTicks += step;
+	if (clockTicks>=HOMECAN_TICKS_PER_SECOND) {
+		clockTicks -= HOMECAN_TICKS_PER_SECOND;
+		clockSeconds++;
+		uptimeSeconds++;
+	}
+}
+
+//returns false if the clock was never synchronized
+bool homecan_getTime(uint32_t *seconds, uint8_t *ticks) {
+	uint8_t tmp_sreg = SREG;
+	cli();
+	*seconds = clockSeconds;
+	*ticks = clockTicks;
+	SREG = tmp_sreg;
+	return clockValid;
+}
+
+void homecan_setTime(uint32_t seconds, uint8_t ticks) {
+	int32_t diff;
+	uint8_t tmp_sreg = SREG;
+	cli();
+	diff = (int32_t)(seconds-clockSeconds);
+	if (clockValid && diff>=-1 && diff<=1) {
+		diff = diff*HOMECAN_TICKS_PER_SECOND + ticks - clockTicks;
+	} else {
+		diff = HOMECAN_CLOCK_STEP+1;
+	}
+	if (diff>HOMECAN_CLOCK_STEP || diff<-HOMECAN_CLOCK_STEP) {
+		//far off, step
+		clockSeconds = seconds;
+		clockTicks = ticks;
+		clockSlew = 0;
+	} else {
+		//keep the clock monotonic, catch up or hold back slowly
+		clockSlew = diff;
+	}
+	clockValid = 1;
+	SREG = tmp_sreg;
+}
+
+//seconds since this node last sent a frame of its own
+uint32_t homecan_getIdleTime(void) {
+	uint32_t idle;
+	uint8_t tmp_sreg = SREG;
+	cli();
+	idle = uptimeSeconds-lastTransmit;
+	SREG = tmp_sreg;
+	return idle;
+}
+
+//CAN bus load in percent, measured by the gateway and distributed with the time
+uint8_t homecan_getBusLoad(void) {
+	return busLoad;
+}
+
+#ifdef CONFIG_HOMECAN_GATEWAY
+static void homecan_ntpArpResult(uint8_t *ip, uint8_t reference_number, uint8_t *mac) {
+	memcpy(ntpmac,mac,6);
+	ntpState = HOMECAN_NTP_STATE_MAC;
+}
+
+//ask the NTP server for the time, the server has to be on the local network
+void homecan_requestTime(const uint8_t *ip) {
+	if (ntpState!=HOMECAN_NTP_STATE_MAC || memcmp(ip,ntpip,4)!=0) {
+		//resolve mac first, answer is handled in the packet loop
+		memcpy(ntpip,ip,4);
+		ntpState = HOMECAN_NTP_STATE_ARP;
+		get_mac_with_arp(ntpip,HOMECAN_NTP_ARP_REF,homecan_ntpArpResult);
+		return;
+	}
+	client_ntp_request(txbuf,ntpip,HOMECAN_NTP_PORT_L,ntpmac);
+}
+
+//broadcast the gateway clock on CAN
+void homecan_transmitTime(void) {
+	homecan_t msg;
+	uint32_t seconds;
+	uint8_t ticks;
+	if (!homecan_getTime(&seconds,&ticks)) return;
+	msg.address = HOMECAN_ADDRESS_BROADCAST;
+	msg.channel = 0;
+	msg.header.priority = HOMECAN_HEADER_PRIO_DEFAULT;
+	msg.header.mode = HOMECAN_HEADER_MODE_SRC;
+	msg.msgtype = HOMECAN_MSGTYPE_TIME;
+	msg.length = 6;
+	msg.data[0] = seconds&0xFF;
+	msg.data[1] = (seconds>>8)&0xFF;
+	msg.data[2] = (seconds>>16)&0xFF;
+	msg.data[3] = seconds>>24;
+	msg.data[4] = ticks;
+	msg.data[5] = busLoad;
+	loadReported = 1;
+	while (!homecan_transmitCAN(&msg)) {
+		_delay_ms(1);
+	}
+#ifdef CONFIG_HOMECAN_UDP
+	//nodes on ethernet only, one gateway is enough
+	if (homecan_forwardsToUDP()) homecan_transmitUDP(&msg);
+#endif
+}
+
+//measure the CAN bus load, called every second. Nodes need the load for their heartbeat
+//backoff even without a clock, a window without TIME frame ends with a TIME frame of the load only
+void homecan_checkBusLoad(void) {
+	homecan_t msg;
+	uint32_t elapsed;
+	uint8_t tmp_sreg = SREG;
+	cli();
+	elapsed = uptimeSeconds-loadStart;
+	SREG = tmp_sreg;
+	if (elapsed<HOMECAN_BUSLOAD_INTERVALL) return;
+	loadStart += elapsed;
+	elapsed = loadByteCounter/elapsed*100/HOMECAN_CAN_BYTES_PER_SECOND;
+	busLoad = (elapsed>100)?100:elapsed;
+	loadByteCounter = 0;
+	if (loadReported) {
+		loadReported = 0;
+		return;
+	}
+	msg.address = HOMECAN_ADDRESS_BROADCAST;
+	msg.channel = 0;
+	msg.header.priority = HOMECAN_HEADER_PRIO_DEFAULT;
+	msg.header.mode = HOMECAN_HEADER_MODE_SRC;
+	msg.msgtype = HOMECAN_MSGTYPE_TIME;
+	msg.length = 1;
+	msg.data[0] = busLoad;
+	while (!homecan_transmitCAN(&msg)) {
+		_delay_ms(1);
+	}
+#ifdef CONFIG_HOMECAN_UDP
+	if (homecan_forwardsToUDP()) homecan_transmitUDP(&msg);
+#endif
+}
+
+static void homecan_transmitNodeEvent(const homecan_node_t *node, uint8_t event) {
+	homecan_t msg;
+	if (!homecan_forwardsToUDP()) return;
+	msg.address = node->address;
+	msg.channel = 0;
+	msg.header.priority = HOMECAN_HEADER_PRIO_DEFAULT;
+	msg.header.mode = HOMECAN_HEADER_MODE_SRC;
+	msg.msgtype = HOMECAN_MSGTYPE_NODE_EVENT;
+	msg.length = 3;
+	msg.data[0] = event;
+	msg.data[1] = node->variant;
+	msg.data[2] = node->firmware;
+	homecan_transmitUDP(&msg);
+}
+
+//update the node directory from any frame a node sent on CAN, heartbeats carry the details
+static void homecan_nodeSeen(const homecan_t *msg) {
+	homecan_node_t *node = NULL;
+	uint8_t i;
+	uint32_t minutes;
+	for (i=0;i<HOMECAN_NODE_DIRECTORY_SIZE;i++) {
+		if (nodes[i].address==msg->address) {
+			node = &nodes[i];
+			break;
+		}
+		//first free slot, else the longest silent lost node
+		if (nodes[i].address==0) {
+			if (node==NULL || node->address!=0) node = &nodes[i];
+		} else if (nodes[i].lost && (node==NULL || (node->address!=0 && nodes[i].age>node->age))) {
+			node = &nodes[i];
+		}
+	}
+	if (node==NULL) return;		//directory full
+	if (node->address!=msg->address) {
+		node->address = msg->address;
+		node->lost = 1;
+		//details of the previous owner are not valid for this node
+		node->variant = 0;
+		node->firmware = 0;
+		node->uptime = 0;
+		node->errors = 0;
+	}
+	node->age = 0;
+	if (msg->msgtype==HOMECAN_MSGTYPE_HEARTBEAT && msg->length>=HOMECAN_HEARTBEAT_LENGTH) {
+		node->variant = msg->data[0];
+		node->firmware = msg->data[1];
+		minutes = msg->data[2] | ((uint32_t)msg->data[3])<<8 | ((uint32_t)msg->data[4])<<16;
+		node->uptime = (minutes/60>0xFFFF)?0xFFFF:minutes/60;
+		node->errors = msg->data[5];
+	}
+	if (node->lost) {
+		node->lost = 0;
+		homecan_transmitNodeEvent(node,HOMECAN_NODE_FOUND);
+	}
+}
+
+//answer a directory query with a single datagram
+static void homecan_transmitNodeDirectory(void) {
+	uint8_t i;
+	uint8_t n = 0;
+	uint8_t *p = &txbuf[UDP_DATA_P+4];
+	send_udp_prepare(txbuf,HOMECAN_UDP_PORT, serverip, HOMECAN_UDP_PORT,broadcastmac);
+	for (i=0;i<HOMECAN_NODE_DIRECTORY_SIZE;i++) {
+		if (nodes[i].address==0) continue;
+		p[0] = nodes[i].address;
+		p[1] = nodes[i].variant;
+		p[2] = nodes[i].firmware;
+		p[3] = nodes[i].errors;
+		p[4] = nodes[i].age&0xFF;
+		p[5] = nodes[i].age>>8;
+		p[6] = nodes[i].uptime&0xFF;
+		p[7] = nodes[i].uptime>>8;
+		p += HOMECAN_NODE_ENTRY_LENGTH;
+		n++;
+	}
+	txbuf[UDP_DATA_P+0] = (uint8_t)(HOMECAN_HEADER_PRIO_DEFAULT<<1 | HOMECAN_HEADER_MODE_SRC);
+	txbuf[UDP_DATA_P+1] = HOMECAN_MSGTYPE_NODE_DIRECTORY;
+	txbuf[UDP_DATA_P+2] = deviceID;
+	txbuf[UDP_DATA_P+3] = n;
+	send_udp_transmit(txbuf,4+n*HOMECAN_NODE_ENTRY_LENGTH);
+}
+
+//age the directory, called every second
+void homecan_checkNodes(void) {
+	uint8_t i;
+	if (peerAddress!=0 && ++peerAge>=HOMECAN_NODE_TIMEOUT) {
+		//peer gateway gone, forward both directions again
+		peerAddress = 0;
+	}
+	for (i=0;i<HOMECAN_NODE_DIRECTORY_SIZE;i++) {
+		if (nodes[i].address==0) continue;
+		if (nodes[i].age<0xFFFF) nodes[i].age++;
+		if (!nodes[i].lost && nodes[i].age>=HOMECAN_NODE_TIMEOUT) {
+			nodes[i].lost = 1;
+			homecan_transmitNodeEvent(&nodes[i],HOMECAN_NODE_LOST);
+		}
+	}
+}
+
+//report frames the shaper dropped, called every second
+void homecan_reportShaper(void) {
+	homecan_t msg;
+	if (shaperDrops==0) return;
+	msg.address = deviceID;
+	msg.channel = 0;
+	msg.header.priority = HOMECAN_HEADER_PRIO_DEFAULT;
+	msg.header.mode = HOMECAN_HEADER_MODE_SRC;
+	msg.msgtype = HOMECAN_MSGTYPE_ERROR;
+	msg.length = 3;
+	msg.data[0] = HOMECAN_ERROR_SHAPER_DROP;
+	msg.data[1] = shaperDrops&0xFF;
+	msg.data[2] = shaperDrops>>8;
+	shaperDrops = 0;
+	homecan_transmit(&msg);
+}
+
 uint32_t homecan_getTxByteCount(void) {
 	uint32_t count = txByteCounter;
 	txByteCounter = 0;
@@ -218,16 +1021,64 @@ uint32_t homecan_getTxByteCount(void) {
 }
 #endif
 
+//CRC of flash pages of the running image, lets the host send only changed pages
+static void homecan_transmitFlashCRC(uint16_t page, uint8_t count) {
+	homecan_t msg;
+	uint32_t addr;
+	uint16_t crc;
+	uint16_t i;
+	if (count>HOMECAN_FLASH_CRC_MAX) count = HOMECAN_FLASH_CRC_MAX;
+	msg.address = deviceID;
+	msg.channel = 0;
+	msg.header.priority = HOMECAN_HEADER_PRIO_DEFAULT;
+	msg.header.mode = HOMECAN_HEADER_MODE_SRC;
+	msg.msgtype = HOMECAN_MSGTYPE_FLASH_CRC;
+	msg.length = 4;
+	for (;count>0;count--,page++) {
+		addr = ((uint32_t)page)*HOMECAN_BLOCK_SIZE;
+		crc = 0;
+		for (i=0;i<HOMECAN_BLOCK_SIZE;i++) {
+			crc = crc16_update(crc,pgm_read_byte_far(addr+i));
+		}
+		msg.data[0] = page&0xFF;
+		msg.data[1] = page>>8;
+		msg.data[2] = crc&0xFF;
+		msg.data[3] = crc>>8;
+		while (!homecan_transmit(&msg)) {
+			_delay_ms(1);
+		}
+	}
+}
+
 bool homecan_receive(homecan_t *msg) {
 	bool res = false;
+	if (heartbeatDelay==1) {
+		heartbeatDelay = 0;
+		homecan_transmitHeartbeat();
+	}
+#ifdef CONFIG_HOMECAN_GATEWAY
+	homecan_shaperDrain();
+	homecan_blockStep();
+#endif
 #ifdef CONFIG_HOMECAN_CAN
 	if (res==false) {
 		res = homecan_receiveCAN(msg);
 #ifdef CONFIG_HOMECAN_GATEWAY
+		if (res==true && homecan_blockAck(msg)) {
+			return false;
+		}
 		if (res==true) {
 			if (msg->address!=deviceID || msg->header.mode!=HOMECAN_HEADER_MODE_DST) {
-				//forward to udp
-				homecan_transmitUDP(msg);
+				if (homecan_isDuplicate(msg)) {
+					dedupDrops++;
+				} else if (homecan_forwardsToUDP()) {
+					//forward to udp
+					homecan_transmitUDP(msg);
+					framesToUDP++;
+				}
+			}
+			if (msg->header.mode==HOMECAN_HEADER_MODE_SRC && msg->address!=HOMECAN_ADDRESS_BROADCAST) {
+				homecan_nodeSeen(msg);
 			}
 		}
 #endif
@@ -238,10 +1089,19 @@ bool homecan_receive(homecan_t *msg) {
 		res = homecan_receiveUDP(msg);
 #ifdef CONFIG_HOMECAN_GATEWAY
 		if (res==true) {
-			if (msg->address!=deviceID || msg->header.mode!=HOMECAN_HEADER_MODE_DST) {
-				//forward to CAN
-				while (!homecan_transmitCAN(msg)) {
-					_delay_ms(1);
+			if (msg->msgtype==HOMECAN_MSGTYPE_HEARTBEAT && msg->header.mode==HOMECAN_HEADER_MODE_SRC && msg->address!=HOMECAN_ADDRESS_BROADCAST
+					&& msg->address!=deviceID && msg->length>=HOMECAN_HEARTBEAT_LENGTH && msg->data[0]==VARIANT_ID) {
+				//heartbeat of another gateway, never bridged
+				peerAddress = msg->address;
+				peerAge = 0;
+			} else if (msg->msgtype==HOMECAN_MSGTYPE_TIME && msg->address==HOMECAN_ADDRESS_BROADCAST) {
+				//time of another gateway, CAN gets it from the gateway with the clock channel
+			} else if (msg->address!=deviceID || msg->header.mode!=HOMECAN_HEADER_MODE_DST) {
+				if (homecan_isDuplicate(msg)) {
+					dedupDrops++;
+				} else if (homecan_forwardsToCAN()) {
+					//forward to CAN
+					homecan_shaperForward(msg,rxbuf[IP_SRC_P+3]);
 				}
 			}
 		}
@@ -249,16 +1109,50 @@ bool homecan_receive(homecan_t *msg) {
 	}
 #endif
 	if (res==true) {
-		//check if call for bootloader
-		if (msg->address==deviceID && msg->msgtype==HOMECAN_MSGTYPE_CALL_BOOTLOADER) {
+		//check if call for bootloader, for this node or for all nodes of its variant
+		if (msg->msgtype==HOMECAN_MSGTYPE_CALL_BOOTLOADER && (msg->address==deviceID
+				|| (msg->address==HOMECAN_ADDRESS_BROADCAST && msg->length>=2 && msg->data[0]==VARIANT_ID))) {
+			eeprom_write_byte((uint8_t*)EEPROM_BOOTLOADER_SESSION,(msg->address==HOMECAN_ADDRESS_BROADCAST)?msg->data[1]:HOMECAN_BOOTLOADER_NO_SESSION);
 			cli();
 			wdt_enable(WDTO_500MS);
 			while (1);
 		}
-		if (msg->address==0 && msg->msgtype==HOMECAN_MSGTYPE_HEARTBEAT) {
-			//we are no gateway but received a heartbeat from a gateway
-			_delay_ms(deviceID);
-			homecan_transmitHeartbeat();
+		if (msg->address==deviceID && msg->header.mode==HOMECAN_HEADER_MODE_DST && msg->msgtype==HOMECAN_MSGTYPE_LOG_SUBSCRIBE && msg->length>=1) {
+			debuglog_subscribe(msg->data[0]);
+			return false;
+		}
+#ifdef CONFIG_SAMPLER
+		if (msg->address==deviceID && msg->header.mode==HOMECAN_HEADER_MODE_DST && msg->msgtype==HOMECAN_MSGTYPE_SAMPLER && msg->length>=4) {
+			sampler_command(msg->data[0],msg->data[1],msg->data[2],msg->data[3]);
+			return false;
+		}
+#endif
+		if (msg->address==deviceID && msg->header.mode==HOMECAN_HEADER_MODE_DST && msg->msgtype==HOMECAN_MSGTYPE_FLASH_CRC && msg->length>=3) {
+			homecan_transmitFlashCRC(msg->data[0] | ((uint16_t)msg->data[1])<<8,msg->data[2]);
+			return false;
+		}
+#ifdef CONFIG_HOMECAN_GATEWAY
+		if (msg->address==deviceID && msg->header.mode==HOMECAN_HEADER_MODE_DST && msg->msgtype==HOMECAN_MSGTYPE_NODE_DIRECTORY) {
+			homecan_transmitNodeDirectory();
+			return false;
+		}
+#endif
+#ifndef CONFIG_HOMECAN_GATEWAY
+		if (msg->address==HOMECAN_ADDRESS_BROADCAST && msg->msgtype==HOMECAN_MSGTYPE_TIME && msg->length==1) {
+			//gateway without clock
+			busLoad = msg->data[0];
+			return false;
+		}
+		if (msg->address==HOMECAN_ADDRESS_BROADCAST && msg->msgtype==HOMECAN_MSGTYPE_TIME && msg->length>=5) {
+			if (msg->length>=6) busLoad = msg->data[5];
+			homecan_setTime(msg->data[0] | ((uint32_t)msg->data[1])<<8 | ((uint32_t)msg->data[2])<<16 | ((uint32_t)msg->data[3])<<24, msg->data[4]);
+			return false;
+		}
+#endif
+		if (msg->address==0 && msg->msgtype==HOMECAN_MSGTYPE_HEARTBEAT && msg->length==0) {
+			//heartbeat request without payload from the server, answer spread by address without blocking
+			//extended heartbeats of other nodes are no request
+			heartbeatDelay = deviceID/4+2;
 			return false;
 		}
 	}
@@ -268,12 +1162,24 @@ bool homecan_receive(homecan_t *msg) {
 
 void homecan_transmitHeartbeat() {
 	homecan_t msg;
+	uint32_t minutes;
+	uint8_t tmp_sreg;
 	msg.address = deviceID;
 	msg.channel = 0;
 	msg.header.priority = HOMECAN_HEADER_PRIO_DEFAULT;
 	msg.header.mode = HOMECAN_HEADER_MODE_SRC;
 	msg.msgtype = HOMECAN_MSGTYPE_HEARTBEAT;
-	msg.length = 0;
+	msg.length = HOMECAN_HEARTBEAT_LENGTH;
+	msg.data[0] = VARIANT_ID;
+	msg.data[1] = FIRMWARE_VERSION;
+	tmp_sreg = SREG;
+	cli();
+	minutes = uptimeSeconds/60;
+	SREG = tmp_sreg;
+	msg.data[2] = minutes&0xFF;
+	msg.data[3] = (minutes>>8)&0xFF;
+	msg.data[4] = (minutes>>16)&0xFF;
+	msg.data[5] = errorCounter;
 	while (!homecan_transmit(&msg)) {
 		_delay_ms(1);
 	}
@@ -4,11 +4,25 @@
 #include <stdbool.h>
 
 #define EEPROM_DEVICE_ID		0x00
+#define EEPROM_BOOTLOADER_SESSION	0xFF0	//read by the bootloader, 0xFF: unicast update
 
 #define HOMECAN_UDP_PORT							15000
 #define HOMECAN_UDP_PORT_BOOTLOADER					15001
 
 #define HOMECAN_ADDRESS_FROM_EEPROM	0
+#define HOMECAN_ADDRESS_BROADCAST	0
+
+#define HOMECAN_TICKS_PER_SECOND	100
+
+#define HOMECAN_HEARTBEAT_INTERVALL	30	//s between periodic heartbeats
+#define HOMECAN_HEARTBEAT_JITTER	4	//s, random extra delay per heartbeat
+#define HOMECAN_HEARTBEAT_FORCED	4	//every n-th heartbeat is sent even if the node was not idle, it carries uptime and errors
+#define HOMECAN_BUSLOAD_HIGH		50	//%, heartbeat interval is doubled above
+#define HOMECAN_CAN_BYTES_PER_SECOND	15625	//125kbit/s
+#define HOMECAN_BUSLOAD_INTERVALL	30	//s, measuring window of the gateway
+#define HOMECAN_NODE_TIMEOUT		(5*HOMECAN_HEARTBEAT_INTERVALL)	//s of silence before the gateway reports a node lost,
+													//a suppressed heartbeat under load can leave a gap of almost 4 intervals
+#define HOMECAN_NODE_DIRECTORY_SIZE	24
 
 typedef enum homecan_msgtype_t {
 	HOMECAN_MSGTYPE_ONOFF				= 0x00,
@@ -22,11 +36,13 @@ typedef enum homecan_msgtype_t {
 #ifdef CONFIG_KWB
 	HOMECAN_MSGTYPE_KWB_HK				= 0x04,
 #endif
+	HOMECAN_MSGTYPE_STOPMOVE			= 0x07,	//declared for every variant, gateways treat it as urgent
 #ifdef CONFIG_RAFFSTORE
-	HOMECAN_MSGTYPE_POSITION			= 0x05,
-	HOMECAN_MSGTYPE_SHADE				= 0x06,
-	HOMECAN_MSGTYPE_STOPMOVE			= 0x07,
+	HOMECAN_MSGTYPE_POSITION			= 0x05,	//payload see HOMECAN_POSITION_LENGTH
+	HOMECAN_MSGTYPE_SHADE				= 0x06,	//DST only, the angle is reported in POSITION
 	HOMECAN_MSGTYPE_UPDOWN				= 0x08,
+	HOMECAN_MSGTYPE_RAFFSTORE_QUEUE		= 0x14,
+	HOMECAN_MSGTYPE_CALIBRATE			= 0x15,
 #endif
 	HOMECAN_MSGTYPE_TEMPERATURE			= 0x09,
 	HOMECAN_MSGTYPE_HUMIDITY			= 0x0A,
@@ -45,8 +61,22 @@ typedef enum homecan_msgtype_t {
 	HOMECAN_MSGTYPE_FLOAT				= 0x20,
 	HOMECAN_MSGTYPE_UINT32				= 0x21,
 
+	HOMECAN_MSGTYPE_ERROR				= 0x30,
+	HOMECAN_MSGTYPE_TIME				= 0x31,
+	HOMECAN_MSGTYPE_SCHEDULE			= 0x32,
+#ifdef CONFIG_TEMP
+	HOMECAN_MSGTYPE_SETPOINT			= 0x33,
+	HOMECAN_MSGTYPE_PID					= 0x34,
+#endif
+#ifdef CONFIG_HOMECAN_GATEWAY
+	HOMECAN_MSGTYPE_NODE_EVENT			= 0x35,
+	HOMECAN_MSGTYPE_NODE_DIRECTORY		= 0x36,
+#endif
+
 #ifdef CONFIG_KEYPAD
 	HOMECAN_MSGTYPE_KEY_SEQUENCE		= 0x80,
+	HOMECAN_MSGTYPE_KEYPAD_CODE			= 0x82,
+	HOMECAN_MSGTYPE_KEYPAD_ACCESS		= 0x84,
 #endif
 	HOMECAN_MSGTYPE_STRING				= 0x81,
 #ifdef CONFIG_IR
@@ -54,6 +84,7 @@ typedef enum homecan_msgtype_t {
 #endif
 #ifdef CONFIG_BUZZER
 	HOMECAN_MSGTYPE_BUZZER				= 0x85,
+	HOMECAN_MSGTYPE_BUZZER_PATTERN		= 0x86,
 #endif
 
 	HOMECAN_MSGTYPE_CHANNEL_CONFIG		= 0xE0,
@@ -64,6 +95,12 @@ typedef enum homecan_msgtype_t {
 	HOMECAN_MSGTYPE_DIMMER_LEARN		= 0xE4,
 #endif
 	HOMECAN_MSGTYPE_REQUEST_STATE		= 0xE5,
+	HOMECAN_MSGTYPE_FLASH_CRC			= 0xE6,
+	HOMECAN_MSGTYPE_LOG_SUBSCRIBE		= 0xE7,	//data[0] minutes to send debug log records, 0 stops
+	HOMECAN_MSGTYPE_SAMPLER				= 0xE8,	//port capture, see sampler.h
+#if defined(CONFIG_ELTAKO) || defined(CONFIG_KWB)
+	HOMECAN_MSGTYPE_BUS_STATS			= 0xE9,	//RS485 counters, see HOMECAN_BUS_STATS_LENGTH
+#endif
 
 	HOMECAN_MSGTYPE_BOOTLOADER			= 0xF0,
 	HOMECAN_MSGTYPE_CALL_BOOTLOADER		= 0xF1,
@@ -72,6 +109,78 @@ typedef enum homecan_msgtype_t {
 } homecan_msgtype_t;
 
 
+//error codes, data[0] of HOMECAN_MSGTYPE_ERROR
+#define HOMECAN_ERROR_SSR_FEEDBACK	0x01	//data[1] requested state
+#define HOMECAN_ERROR_SHAPER_DROP	0x02	//gateway, data[1..2] UDP frames not forwarded to CAN in the last second
+#define HOMECAN_ERROR_SENSOR_STALE	0x03	//thermostat, data[1] sensor channel without update, actuator switched off
+
+//keypad access results, data[0] of HOMECAN_MSGTYPE_KEYPAD_ACCESS, data[1] is the code slot
+#define HOMECAN_KEYPAD_GRANTED		0x00
+#define HOMECAN_KEYPAD_DENIED		0x01
+#define HOMECAN_KEYPAD_LOCKED		0x02
+
+//HOMECAN_MSGTYPE_POSITION of a raffstore:
+//  DST: data[0] target position 0..255, the angle is kept
+//  SRC: data[0] position 0..255, data[1] angle 0..255, data[2] estimated drift (0,1s, 255 is 25,5s or more)
+//Older firmware sent SRC POSITION with length 1 plus a separate SHADE frame with the angle.
+#define HOMECAN_POSITION_LENGTH		3
+
+//HOMECAN_MSGTYPE_BUS_STATS, a DST request is answered with one SRC frame per RS485 bus:
+//  channel UART, data[0] protocol, data[1..2] frames, data[3..4] checksum errors, counters wrap
+#define HOMECAN_BUS_STATS_LENGTH	5
+#define HOMECAN_BUS_ELTAKO			0x01
+#define HOMECAN_BUS_KWB				0x02
+
+//HOMECAN_MSGTYPE_HEARTBEAT: data[0] variant, data[1] firmware version, data[2..4] uptime (min), data[5] error frames sent
+#define HOMECAN_HEARTBEAT_LENGTH	6
+
+//node events, data[0] of HOMECAN_MSGTYPE_NODE_EVENT, address is the node, data[1..2] variant and firmware
+#define HOMECAN_NODE_LOST			0x00
+#define HOMECAN_NODE_FOUND			0x01
+
+//HOMECAN_MSGTYPE_NODE_DIRECTORY: DST query to the gateway, answered with one UDP datagram,
+//channel is the number of entries, 8 bytes each after the header:
+//address, variant, firmware, errors, last seen (s ago, 16 bit), uptime (h, 16 bit)
+#define HOMECAN_NODE_ENTRY_LENGTH	8
+
+//multicast firmware update: HOMECAN_MSGTYPE_CALL_BOOTLOADER to HOMECAN_ADDRESS_BROADCAST,
+//data[0] variant, data[1] session id. Matching nodes store the session and start the bootloader,
+//which then also accepts HOMECAN_MSGTYPE_BOOTLOADER frames sent to HOMECAN_ADDRESS_BROADCAST.
+//At the end every node reports its missing blocks on the bootloader port:
+//data[0] node address, data[1] HOMECAN_BOOTLOADER_MISSING, data[2..3] first block, data[4..7] bitmap of the next 32 blocks
+#define HOMECAN_BOOTLOADER_MISSING	0xFE
+#define HOMECAN_BOOTLOADER_NO_SESSION	0xFF
+
+//buffered block transfer, the host sends one datagram per flash page to the bootloader port:
+//address, HOMECAN_BOOTLOADER_BLOCK, block number (16 bit), up to HOMECAN_BLOCK_SIZE bytes, a longer one FAILED.
+//The gateway streams it on CAN as BOOTLOADER frames, data[0] address, data[1] sequence:
+//  sequence 0: data[1]=HOMECAN_BOOTLOADER_BLOCK, data[2..3] block number, data[4..5] length,
+//              data[6..7] CRC-16/XMODEM of the payload, the node checks it before writing the page
+//  sequence 1..n: data[2..7] payload
+//The datagram itself needs no CRC, the ENC28J60 drops ethernet frames with a bad FCS and
+//the host can verify the written pages with HOMECAN_MSGTYPE_FLASH_CRC.
+//The node acknowledges with data[1]=HOMECAN_BOOTLOADER_ACK, data[2] next expected sequence, data[3] HOMECAN_BLOCK_ status.
+//The host only gets the block result: address, HOMECAN_BOOTLOADER_BLOCK, block number, HOMECAN_BLOCK_ status
+//A multicast block is paced by time and reported WRITTEN after the page write delay, it is never acknowledged.
+#define HOMECAN_BOOTLOADER_BLOCK	0xFD
+#define HOMECAN_BOOTLOADER_ACK		0xFC
+#define HOMECAN_BLOCK_SIZE			256
+#define HOMECAN_BLOCK_PAYLOAD		6
+#define HOMECAN_BLOCK_RECEIVING		0x00
+#define HOMECAN_BLOCK_WRITTEN		0x01
+#define HOMECAN_BLOCK_FAILED		0x02
+#define HOMECAN_BLOCK_TIMEOUT		0x03
+#define HOMECAN_BLOCK_BUSY			0x04
+//delta update: the host asks the running firmware for page CRCs (HOMECAN_MSGTYPE_FLASH_CRC,
+//DST data[0..1] first page, data[2] count) and only transfers pages that differ, block number = page.
+//Each page is answered with data[0..1] page, data[2..3] CRC-16/XMODEM over HOMECAN_BLOCK_SIZE bytes.
+#define HOMECAN_FLASH_CRC_MAX		16
+
+//HOMECAN_MSGTYPE_TIME: data[0..3] unix time (s, little endian), data[4] 10ms ticks, data[5] CAN bus load (%)
+//without a synchronized clock the gateway sends length 1: data[0] CAN bus load (%)
+//optional event timestamp appended to state frames: 3 bytes, 10ms ticks since 00:00 UTC (little endian)
+#define HOMECAN_TIMESTAMP_LENGTH	3
+
 #define HOMECAN_HEADER_MODE_SRC		0
 #define HOMECAN_HEADER_MODE_DST		1
 #define HOMECAN_HEADER_PRIO_DEFAULT	0x7
@@ -97,9 +206,23 @@ bool homecan_transmit(const homecan_t *msg);
 bool homecan_receive(homecan_t *msg);
 void homecan_transmitHeartbeat(void);
 uint8_t homecan_getDeviceID(void);
+void homecan_tick(void);
+bool homecan_getTime(uint32_t *seconds, uint8_t *ticks);
+void homecan_setTime(uint32_t seconds, uint8_t ticks);
+uint32_t homecan_getIdleTime(void);
+uint8_t homecan_getBusLoad(void);
+
+#ifdef CONFIG_HOMECAN_UDP
+void homecan_checkNetwork(void);
+#endif
 
 #ifdef CONFIG_HOMECAN_GATEWAY
 uint32_t homecan_getTxByteCount(void);
+void homecan_requestTime(const uint8_t *ntpip);
+void homecan_transmitTime(void);
+void homecan_checkNodes(void);
+void homecan_checkBusLoad(void);
+void homecan_reportShaper(void);
 #endif
 
 #endif
@@ -30,7 +30,7 @@
 
 static uint8_t macaddr[6];
 static uint8_t ipaddr[4]={0,0,0,0};
-#if defined (TCP_client)
+#if defined (TCP_client) || defined (WWW_server)
 static uint8_t seqnum=0xa; // my initial tcp sequence number
 #endif
 static void (*icmp_callback)(uint8_t *ip);
@@ -1308,8 +1308,10 @@ uint8_t packetloop_icmp_checkreply(uint8_t *buf,uint8_t *ip_monitoredhost)
 // of the tcp data if there is tcp data part
 uint16_t packetloop_arp_icmp_tcp(uint8_t *buf,uint16_t plen)
 {
-#if defined (TCP_client)
+#if defined (TCP_client) || defined (WWW_server)
 	uint16_t len;
+#endif
+#if defined (TCP_client)
 	uint8_t send_fin=0;
 	uint16_t tcpstart;
 	uint16_t save_len;
@@ -15,14 +15,22 @@
 #define IP_CONFIG_H
 
 //------------- functions in ip_arp_udp_tcp.c --------------
-// an NTP client (ntp clock):
+// an NTP client (ntp clock), the gateway distributes the time on CAN:
+#ifdef CONFIG_NETWORKCAN
+#define NTP_client
+#else
 #undef NTP_client
+#endif
 // a spontanious sending UDP client (needed as well for DNS and DHCP)
 #define UDP_client
 // a server answering to UDP messages
 #define UDP_server
-// a web server
+// a web server, the gateway serves its metrics page:
+#ifdef CONFIG_NETWORKCAN
+#define WWW_server
+#else
 #undef WWW_server
+#endif
 
 // to send out a ping:
 #undef PING_client
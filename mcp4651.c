@@ -1,9 +1,28 @@
 #include <stdint.h>
+#include <stdbool.h>
+#include <util/twi.h>
+#include <util/delay.h>
 #include "mcp4651.h"
 #include "i2cmaster.h"
 
 #define MCP4651  0x50
 
+//states of the non-blocking wiper write
+#define MCP4651_IDLE	0
+#define MCP4651_START	1
+#define MCP4651_ADDR	2
+#define MCP4651_CMD		3
+#define MCP4651_DATA	4
+
+#define MCP4651_RETRIES	3		//attempts per wiper value before it is dropped
+#define MCP4651_FLUSH_POLLS	1000	//x10us, an async write takes <1ms at 100kHz
+
+static uint8_t state = MCP4651_IDLE;
+static uint8_t pendingMask = 0;
+static uint16_t pending[2];
+static uint8_t activeWiper;
+static uint16_t activeValue;
+static uint8_t retries = 0;
 
 void mcp4651_init(void) {
 	i2c_start_wait(MCP4651+I2C_WRITE);     	// set device address and write mode
@@ -20,3 +39,93 @@ void mcp4651_setWiper(uint8_t wiper,uint16_t value) {
   	i2c_stop();	
 }
 
+void mcp4651_setWiperAsync(uint8_t wiper,uint16_t value) {
+	if (wiper>1) return;
+	//only the latest value per wiper is written
+	pending[wiper] = value;
+	pendingMask |= 1<<wiper;
+}
+
+static void mcp4651_abort(void) {
+	TWCR = (1<<TWINT) | (1<<TWEN) | (1<<TWSTO);
+	state = MCP4651_IDLE;
+	//retry with the next poll, unless a newer value is queued or the device keeps failing
+	retries++;
+	if (retries>=MCP4651_RETRIES) {
+		retries = 0;
+	} else if (!(pendingMask&(1<<activeWiper))) {
+		pending[activeWiper] = activeValue;
+		pendingMask |= 1<<activeWiper;
+	}
+}
+
+//advance a pending wiper write by one TWI step, never waits, returns false if idle
+bool mcp4651_poll(void) {
+	if (state!=MCP4651_IDLE && !(TWCR & (1<<TWINT))) {
+		//TWI still busy
+		return true;
+	}
+	switch (state) {
+	case MCP4651_IDLE:
+		if (TWCR & (1<<TWSTO)) return true;
+		if (pendingMask==0) return false;
+		activeWiper = (pendingMask&0x01)?0:1;
+		activeValue = pending[activeWiper];
+		pendingMask &= ~(1<<activeWiper);
+		TWCR = (1<<TWINT) | (1<<TWSTA) | (1<<TWEN);
+		state = MCP4651_START;
+		break;
+	case MCP4651_START:
+		if ((TW_STATUS & 0xF8)!=TW_START) {
+			mcp4651_abort();
+			break;
+		}
+		TWDR = MCP4651+I2C_WRITE;
+		TWCR = (1<<TWINT) | (1<<TWEN);
+		state = MCP4651_ADDR;
+		break;
+	case MCP4651_ADDR:
+		if ((TW_STATUS & 0xF8)!=TW_MT_SLA_ACK) {
+			//device busy
+			mcp4651_abort();
+			break;
+		}
+		TWDR = ((activeWiper&0x03)<<4)|((activeValue&0x1FF)>>8);
+		TWCR = (1<<TWINT) | (1<<TWEN);
+		state = MCP4651_CMD;
+		break;
+	case MCP4651_CMD:
+		if ((TW_STATUS & 0xF8)!=TW_MT_DATA_ACK) {
+			mcp4651_abort();
+			break;
+		}
+		TWDR = activeValue&0xFF;
+		TWCR = (1<<TWINT) | (1<<TWEN);
+		state = MCP4651_DATA;
+		break;
+	case MCP4651_DATA:
+		if ((TW_STATUS & 0xF8)!=TW_MT_DATA_ACK) {
+			mcp4651_abort();
+			break;
+		}
+		TWCR = (1<<TWINT) | (1<<TWEN) | (1<<TWSTO);
+		state = MCP4651_IDLE;
+		retries = 0;
+		break;
+	}
+	return true;
+}
+
+//finish a queued wiper write before blocking TWI access, gives up on a hung bus
+bool mcp4651_flush(void) {
+	uint16_t polls = MCP4651_FLUSH_POLLS;
+	while (mcp4651_poll()) {
+		if (--polls==0) {
+			//release the bus, the queued values are kept
+			if (state!=MCP4651_IDLE) mcp4651_abort();
+			return false;
+		}
+		_delay_us(10);
+	}
+	return true;
+}
@@ -2,11 +2,16 @@
 #define __MCP4651_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #define MCP4651_WIPER1	0
 #define MCP4651_WIPER2	1
 
 void mcp4651_init(void);
 void mcp4651_setWiper(uint8_t wiper,uint16_t value);
+//queue a wiper write, done by mcp4651_poll() without blocking
+void mcp4651_setWiperAsync(uint8_t wiper,uint16_t value);
+bool mcp4651_poll(void);
+bool mcp4651_flush(void);
 
 #endif
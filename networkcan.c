@@ -38,6 +38,16 @@ circuit_t channelconfig_getPortType(uint8_t port) {
 	return portconfig[port].circuit;
 }
 
+#if defined(CONFIG_ELTAKO) || defined(CONFIG_KWB)
+uint8_t channelconfig_getPortUart(uint8_t port) {
+	switch (port) {
+		case 2:
+		case 3: return 1;
+	}
+	return CHANNELCONFIG_NO_UART;
+}
+#endif
+
 uint8_t channelconfig_getMaxPort() {
 	return CHANNELCONFIG_MAX_PORT;
 }
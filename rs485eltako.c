@@ -6,103 +6,110 @@
  */ 
 
 #include <avr/io.h>
+#include <string.h>
 #include "uart2.h"
 #include "rs485eltako.h"
 
-rs485eltako_t msgrx;
-
-typedef void (*voidFuncPtru08)(const rs485eltako_t *msg);
-volatile static voidFuncPtru08 appRxFuncHandler;
-
 #define MODE_WAITING_FOR_PREAMBLE 0
 #define MODE_RECEIVED_SYNC_BYTE1 1
 #define MODE_IN_FRAME 2
 
-uint8_t mode;
-uint8_t byteIdx;
-uint8_t frameLen;
-uint8_t checksum;
-
-void rs485eltako_init(void) {
-	uart1Init();
-	uartSetBaudRate(1,RS485ELTAKO_BAUDRATE);
-	mode = MODE_WAITING_FOR_PREAMBLE;
+void rs485eltako_init(rs485eltako_bus_t *bus, uint8_t uart) {
+	memset(bus,0,sizeof(rs485eltako_bus_t));
+	bus->uart = uart;
+	if (uart==0) {
+		uart0Init();
+	} else {
+		uart1Init();
+	}
+	uartSetBaudRate(uart,RS485ELTAKO_BAUDRATE);
+	bus->mode = MODE_WAITING_FOR_PREAMBLE;
 }
 
-uint8_t rs485eltako_transmitMessage(const rs485eltako_t *msg) {
+uint8_t rs485eltako_transmitMessage(rs485eltako_bus_t *bus, const rs485eltako_t *msg) {
 	uint8_t i;
 	uint8_t checksum;
 	char *msgbuf;
 
-	if (uartTransmitPending(1)) return 0;
+	if (uartTransmitPending(bus->uart)) return 0;
 	
-	uartAddToTxBuffer(1,RS485ELTAKO_SYNCBYTE1);
-	uartAddToTxBuffer(1,RS485ELTAKO_SYNCBYTE2);
+	uartAddToTxBuffer(bus->uart,RS485ELTAKO_SYNCBYTE1);
+	uartAddToTxBuffer(bus->uart,RS485ELTAKO_SYNCBYTE2);
 	checksum = 0;
-	uartAddToTxBuffer(1,RS485ELTAKO_LENGTH);
+	uartAddToTxBuffer(bus->uart,RS485ELTAKO_LENGTH);
 	checksum+=RS485ELTAKO_LENGTH;	
-	uartAddToTxBuffer(1,msg->org);
-	uartAddToTxBuffer(1,msg->databuf[3]);
-	uartAddToTxBuffer(1,msg->databuf[2]);
-	uartAddToTxBuffer(1,msg->databuf[1]);
-	uartAddToTxBuffer(1,msg->databuf[0]);
-	uartAddToTxBuffer(1,msg->idbuf[3]);
-	uartAddToTxBuffer(1,msg->idbuf[2]);
-	uartAddToTxBuffer(1,msg->idbuf[1]);
-	uartAddToTxBuffer(1,msg->idbuf[0]);	
+	uartAddToTxBuffer(bus->uart,msg->org);
+	uartAddToTxBuffer(bus->uart,msg->databuf[3]);
+	uartAddToTxBuffer(bus->uart,msg->databuf[2]);
+	uartAddToTxBuffer(bus->uart,msg->databuf[1]);
+	uartAddToTxBuffer(bus->uart,msg->databuf[0]);
+	uartAddToTxBuffer(bus->uart,msg->idbuf[3]);
+	uartAddToTxBuffer(bus->uart,msg->idbuf[2]);
+	uartAddToTxBuffer(bus->uart,msg->idbuf[1]);
+	uartAddToTxBuffer(bus->uart,msg->idbuf[0]);	
 	msgbuf =(char*)msg;
 	for (i=0;i<sizeof(rs485eltako_t);i++) {		
 		checksum+=msgbuf[i];
 	}
-	uartAddToTxBuffer(1,RS485ELTAKO_STATUS);
+	uartAddToTxBuffer(bus->uart,RS485ELTAKO_STATUS);
 	checksum+=RS485ELTAKO_STATUS;
-	uartAddToTxBuffer(1,checksum);
-	uartSendTxBuffer(1);
+	uartAddToTxBuffer(bus->uart,checksum);
+	uartSendTxBuffer(bus->uart);
 	return 1;
 }
 
-void rs485eltako_setRxHandler(void (*rx_func)(const rs485eltako_t *msg)) {
-	appRxFuncHandler = rx_func;
+void rs485eltako_setRxHandler(rs485eltako_bus_t *bus, void (*rx_func)(const rs485eltako_bus_t *bus, const rs485eltako_t *msg)) {
+	bus->rxHandler = rx_func;
+}
+
+void rs485eltako_getStats(const rs485eltako_bus_t *bus, uint16_t *frames, uint16_t *checksumErrors) {
+	*frames = bus->frames;
+	*checksumErrors = bus->checksumErrors;
 }
 
-void rs485eltakoReceiveTask(void) {
+void rs485eltakoReceiveTask(rs485eltako_bus_t *bus) {
 	uint8_t data;	
 	//Check if new data available and get it
-	if (uartReceiveByte(1,&data)) {		
-		switch (mode) {
+	if (uartReceiveByte(bus->uart,&data)) {		
+		switch (bus->mode) {
 			case MODE_WAITING_FOR_PREAMBLE:
 				if (data==RS485ELTAKO_SYNCBYTE1) {
-					mode = MODE_RECEIVED_SYNC_BYTE1;
+					bus->mode = MODE_RECEIVED_SYNC_BYTE1;
 				} 			
 				break;	
 			case MODE_RECEIVED_SYNC_BYTE1:
 				if (data==RS485ELTAKO_SYNCBYTE2) {
-					mode = MODE_IN_FRAME;
-					byteIdx = 0;						
+					bus->mode = MODE_IN_FRAME;
+					bus->byteIdx = 0;						
 				} else {
 					//preamble wrong change back to searching for full preamble
-					mode = MODE_WAITING_FOR_PREAMBLE;
+					bus->mode = MODE_WAITING_FOR_PREAMBLE;
 				}						
 				break;
 			case MODE_IN_FRAME:				
-				if (byteIdx==0) { 
-					frameLen = data&0x1F; //mask out H_SEQ, just keep LENGTH
-					checksum = data;					
+				if (bus->byteIdx==0) { 
+					bus->frameLen = data&0x1F; //mask out H_SEQ, just keep LENGTH
+					bus->checksum = data;					
 				} else {				
-					if (byteIdx==1) msgrx.org = data;
-					if (byteIdx>=2 && byteIdx<=5) msgrx.databuf[5-byteIdx] = data;
-					if (byteIdx>=6 && byteIdx<=9) msgrx.idbuf[9-byteIdx] = data;
+					if (bus->byteIdx==1) bus->msgrx.org = data;
+					if (bus->byteIdx>=2 && bus->byteIdx<=5) bus->msgrx.databuf[5-bus->byteIdx] = data;
+					if (bus->byteIdx>=6 && bus->byteIdx<=9) bus->msgrx.idbuf[9-bus->byteIdx] = data;
 					
 					//calculate checksum	
-					if (byteIdx<frameLen) {
-						checksum+=data;
+					if (bus->byteIdx<bus->frameLen) {
+						bus->checksum+=data;
 					} else {
-						mode = MODE_WAITING_FOR_PREAMBLE;							
-						if (checksum==data) appRxFuncHandler(&msgrx);
+						bus->mode = MODE_WAITING_FOR_PREAMBLE;							
+						if (bus->checksum==data) {
+							bus->frames++;
+							if (bus->rxHandler) bus->rxHandler(bus,&bus->msgrx);
+						} else {
+							bus->checksumErrors++;
+						}
 					}
 					
 				}	
-				byteIdx++;				
+				bus->byteIdx++;				
 				break;			
 		}								
 	}
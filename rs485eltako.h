@@ -22,6 +22,20 @@ typedef struct
 	};	
 } rs485eltako_t ;
 
+//parser state and statistics of one bus, bound to a UART
+typedef struct rs485eltako_bus_t
+{
+	uint8_t uart;
+	uint8_t mode;
+	uint8_t byteIdx;
+	uint8_t frameLen;
+	uint8_t checksum;
+	rs485eltako_t msgrx;
+	void (*rxHandler)(const struct rs485eltako_bus_t *bus, const rs485eltako_t *msg);
+	uint16_t frames;			//received with valid checksum
+	uint16_t checksumErrors;
+} rs485eltako_bus_t ;
+
 #define RS485ELTAKO_BAUDRATE		9600
 
 #define RS485ELTAKO_ORG_RPS			0x05
@@ -54,16 +68,19 @@ typedef struct
 
 
 //functions
-extern void rs485eltako_init(void);
+extern void rs485eltako_init(rs485eltako_bus_t *bus, uint8_t uart);
 
 //return false if old transmission not yet completed
-extern uint8_t rs485eltako_transmitMessage(const rs485eltako_t *msg);
+extern uint8_t rs485eltako_transmitMessage(rs485eltako_bus_t *bus, const rs485eltako_t *msg);
 
 //called if msg received through previously called rs485eltakoReceiveTask
-void rs485eltako_setRxHandler(void (*rx_func)(const rs485eltako_t *msg));
+void rs485eltako_setRxHandler(rs485eltako_bus_t *bus, void (*rx_func)(const rs485eltako_bus_t *bus, const rs485eltako_t *msg));
+
+//call from app main task, once per bus
+void rs485eltakoReceiveTask(rs485eltako_bus_t *bus);
 
-//call from app main task
-void rs485eltakoReceiveTask(void);
+//frames received with valid checksum and frames dropped for a wrong one
+void rs485eltako_getStats(const rs485eltako_bus_t *bus, uint16_t *frames, uint16_t *checksumErrors);
 
 uint32_t rs485eltako_createDimmerValue(uint8_t value);
 
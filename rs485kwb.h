@@ -40,6 +40,24 @@ typedef struct
 	};	
 } rs485kwb_t ;
 
+//parser state and statistics of one bus, bound to a UART
+typedef struct rs485kwb_bus_t
+{
+	uint8_t uart;
+	uint8_t mode;
+	uint8_t byteIdx;
+	uint8_t frameLen;
+	uint8_t checksum;
+	uint8_t preamblebuf[5];
+	uint8_t preambleidx;
+	uint8_t tempIdx;
+	uint8_t pos;
+	rs485kwb_t msgrx;
+	void (*rxHandler)(const struct rs485kwb_bus_t *bus, const rs485kwb_t *msg);
+	uint16_t frames;
+	uint16_t checksumErrors;	//counted only, frames are still delivered
+} rs485kwb_bus_t ;
+
 #define RS485KWB_CTRLMSG		0x01
 #define RS485KWB_SENSEMSG		0x02
 
@@ -57,15 +75,18 @@ typedef struct
 
 
 //functions
-extern void rs485kwb_init(void);
+extern void rs485kwb_init(rs485kwb_bus_t *bus, uint8_t uart);
 
 //return false if old transmission not yet completed
 //extern uint8_t rs485kwb_transmitMessage(const rs485kwb_t *msg);
 
 //called if msg received through previously called rs485kwbReceiveTask
-void rs485kwb_setRxHandler(void (*rx_func)(const rs485kwb_t *msg));
+void rs485kwb_setRxHandler(rs485kwb_bus_t *bus, void (*rx_func)(const rs485kwb_bus_t *bus, const rs485kwb_t *msg));
+
+//call from app main task, once per bus
+void rs485kwbReceiveTask(rs485kwb_bus_t *bus);
 
-//call from app main task
-void rs485kwbReceiveTask(void);
+//frames received and how many of them had a wrong checksum
+void rs485kwb_getStats(const rs485kwb_bus_t *bus, uint16_t *frames, uint16_t *checksumErrors);
 
 #endif /* RS485KWB_H_ */
@@ -0,0 +1,171 @@
+/*
+ * sampler.c
+ *
+ * Port sampler for input diagnostics, captures one PIN register run-length compressed
+ *
+ * Timer1 interrupts only at the sample rate. The ISR reads the port, compares
+ * with the last value and either extends the current run or opens a new one.
+ * Worst case is about 80 cycles including prologue, i.e. 5% CPU at 10kHz and
+ * less at lower rates. The 10ms ISR may be delayed by one sample at most.
+ * A capture is bounded by SAMPLER_RUNS and SAMPLER_MAX_SAMPLES, the timer is
+ * switched off afterwards, an armed sampler costs the same as a running one.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+
+#include "global.h"
+#include "homecan.h"
+#include "sampler.h"
+
+#ifdef CONFIG_IR
+#error "sampler and IR both need timer1"
+#endif
+
+#define SAMPLER_RUNS		128		//2 bytes each
+#define SAMPLER_PER_TASK	4		//frames per 100ms
+#define SAMPLER_PRESCALER	8
+
+typedef enum {
+	SAMPLER_IDLE = 0,
+	SAMPLER_ARMED,
+	SAMPLER_RUNNING,
+	SAMPLER_DONE
+} sampler_state_t;
+
+typedef struct {
+	uint8_t value;
+	uint8_t length;		//samples
+} sampler_run_t;
+
+static volatile uint8_t * const sampler_pins[] = { &PINA, &PINB, &PINC, &PIND, &PINE, &PINF, &PING };
+
+static sampler_run_t runs[SAMPLER_RUNS];
+static volatile sampler_state_t state = SAMPLER_IDLE;
+static volatile uint8_t *pin;
+static uint8_t pinMask;
+static uint8_t pinDivider;
+static uint8_t portIdx;
+static volatile uint8_t runIdx;
+static volatile uint16_t samples;
+static uint8_t lastValue;
+static uint8_t frameIdx;	//next frame to send, 0 is the header
+
+static void sampler_stop(void) {
+	TIMSK1 &= ~(1<<OCIE1A);
+	TCCR1B = 0;
+}
+
+ISR(TIMER1_COMPA_vect) {
+	uint8_t value = *pin & pinMask;
+	if (state==SAMPLER_ARMED) {
+		if (value==lastValue) return;
+		state = SAMPLER_RUNNING;
+		runIdx = 0;
+		runs[0].value = value;
+		runs[0].length = 0;
+		lastValue = value;
+	}
+	if (value==lastValue && runs[runIdx].length<0xFF) {
+		runs[runIdx].length++;
+	} else if (runIdx<SAMPLER_RUNS-1) {
+		runIdx++;
+		runs[runIdx].value = value;
+		runs[runIdx].length = 1;
+		lastValue = value;
+	} else {
+		//buffer full
+		sampler_stop();
+		state = SAMPLER_DONE;
+		return;
+	}
+	if (++samples>=SAMPLER_MAX_SAMPLES) {
+		sampler_stop();
+		state = SAMPLER_DONE;
+	}
+}
+
+void sampler_command(uint8_t cmd, uint8_t port, uint8_t mask, uint8_t divider) {
+	uint8_t tmp_sreg = SREG;
+	cli();
+	if (cmd==SAMPLER_CMD_STOP) {
+		sampler_stop();
+		if (state==SAMPLER_RUNNING || state==SAMPLER_ARMED) {
+			if (state==SAMPLER_ARMED) runIdx = 0;
+			state = SAMPLER_DONE;
+		}
+	} else if (port<sizeof(sampler_pins)/sizeof(sampler_pins[0])) {
+		sampler_stop();
+		pin = sampler_pins[port];
+		portIdx = port;
+		pinMask = mask;
+		pinDivider = divider;
+		samples = 0;
+		runIdx = 0;
+		frameIdx = 0;
+		lastValue = *pin & pinMask;
+		runs[0].value = lastValue;
+		runs[0].length = 0;
+		state = (cmd==SAMPLER_CMD_ARM)?SAMPLER_ARMED:SAMPLER_RUNNING;
+		//CTC, 2MHz timer clock, 200 counts per 100us
+		TCNT1 = 0;
+		OCR1A = (F_CPU/SAMPLER_PRESCALER/SAMPLER_RATE)*(divider+1)-1;
+		TCCR1A = 0;
+		TCCR1B = (1<<WGM12) | (1<<CS11);
+		TIFR1 = (1<<OCF1A);
+		TIMSK1 |= (1<<OCIE1A);
+	}
+	SREG = tmp_sreg;
+}
+
+//header: channel 0, data[0] port, data[1] mask, data[2] divider, data[3] runs, data[4..5] samples
+//runs: channel 1..n, data[0..7] four pairs of value and length in samples, length 0 pads the last frame
+static void sampler_send(void) {
+	homecan_t msg;
+	//run 0 stays empty if the pin changed before the first sample
+	uint8_t first = (runs[0].length==0)?1:0;
+	uint8_t count = runIdx+1-first;
+	uint8_t i, r;
+	msg.address = homecan_getDeviceID();
+	msg.channel = frameIdx;
+	msg.header.priority = HOMECAN_HEADER_PRIO_DEFAULT;
+	msg.header.mode = HOMECAN_HEADER_MODE_SRC;
+	msg.msgtype = HOMECAN_MSGTYPE_SAMPLER;
+	msg.length = 8;
+	if (samples==0) count = 0;	//stopped before the first sample
+	if (frameIdx==0) {
+		msg.length = 6;
+		msg.data[0] = portIdx;
+		msg.data[1] = pinMask;
+		msg.data[2] = pinDivider;
+		msg.data[3] = count;
+		msg.data[4] = samples&0xFF;
+		msg.data[5] = samples>>8;
+	} else {
+		for (i=0;i<4;i++) {
+			r = (frameIdx-1)*4+i;
+			if (r<count) {
+				msg.data[2*i] = runs[first+r].value;
+				msg.data[2*i+1] = runs[first+r].length;
+			} else {
+				msg.data[2*i] = 0;
+				msg.data[2*i+1] = 0;
+			}
+		}
+	}
+	while (!homecan_transmit(&msg)) {
+		_delay_ms(1);
+	}
+	frameIdx++;
+	if ((uint16_t)(frameIdx-1)*4>=count) {
+		state = SAMPLER_IDLE;
+	}
+}
+
+void sampler_task(void) {
+	uint8_t n;
+	for (n=0;n<SAMPLER_PER_TASK && state==SAMPLER_DONE;n++) {
+		sampler_send();
+	}
+}
@@ -0,0 +1,27 @@
+/*
+ * sampler.h
+ *
+ * Port sampler for input diagnostics, captures one PIN register run-length compressed
+ */
+
+#ifndef SAMPLER_H_
+#define SAMPLER_H_
+
+#include <stdint.h>
+
+//HOMECAN_MSGTYPE_SAMPLER commands, data[0] of the DST frame
+#define SAMPLER_CMD_START		0x00	//capture now
+#define SAMPLER_CMD_ARM			0x01	//capture from the first edge on the masked pins
+#define SAMPLER_CMD_STOP		0x02	//end the capture and send what was recorded
+
+//sample rate is SAMPLER_RATE/(divider+1)
+#define SAMPLER_RATE			10000
+//a capture ends when the buffer is full or after this many samples (6s at 10kHz)
+#define SAMPLER_MAX_SAMPLES		60000
+
+//DST data[1] port (0=PINA .. 6=PING), data[2] pin mask, data[3] divider
+void sampler_command(uint8_t cmd, uint8_t port, uint8_t mask, uint8_t divider);
+//every 100ms, streams a finished capture
+void sampler_task(void);
+
+#endif /* SAMPLER_H_ */
@@ -6,6 +6,7 @@
  */ 
 
 #include <avr/io.h>
+#include <avr/eeprom.h>
 #include <util/delay.h>
 #include <avr/interrupt.h>
 #include <string.h>
@@ -13,6 +14,7 @@
 #include "global.h"
 #include "channelconfig.h"
 #include "homecan.h"
+#include "debuglog.h"
 
 #define SENSORCAN_KEYPAD_PORT 10
 
@@ -125,63 +127,40 @@ void channelconfig_setBuzzer(uint16_t freq) {
 The output frequency is computed from the following formula: Fo = Fclk / (2.N.(1+OCR1A)), where N=8 is the clock prescaling factor and Fclk is 16MHz. To output a 400Hz square wave: OCR1A = 2500 � 1 = 2499, where 2500 is the period of the signal in �s.
 OCR1A = Fclk / (Fo*2*N) -1
 */
-		uint16_t regval = F_CPU/(freq*2*8) - 1;
-		OCR1AH = regval>>8;
-		OCR1AL = regval&0xff;
-		if (freq!=0)
+		if (freq!=0) {
+			uint16_t regval = F_CPU/(freq*2UL*8) - 1;
+			OCR1AH = regval>>8;
+			OCR1AL = regval&0xff;
 			DDRB |= (1<<DDB5);
-		else
+		} else {
 			DDRB &= ~(1<<DDB5);
+		}
 }
 
 #ifdef CONFIG_KEYPAD
 
 #define KEY_COUNT 12
 #define KEY_ROW_COUNT 4
-#define KEY_ROW_STATE_INACTIVE 0
-#define KEY_ROW_STATE_ACTIVE 1
-
-void setKeyRow(uint8_t row,uint8_t state) {
-	//if (row>=KEY_ROW_COUNT) return;
-	if (state==KEY_ROW_STATE_ACTIVE) {
-		switch (row) {
-			case 0: 
-				PORTA &= ~(1<<PA5);
-				DDRA |= (1<<DDA5);
-				break;
-			case 1: 
-				PORTA &= ~(1<<PA6);
-				DDRA |= (1<<DDA6);
-				break;
-			case 2:	
-				PORTC &= ~(1<<PC4);
-				DDRC |= (1<<DDC4);
-				break;
-			case 3:	
-				PORTC &= ~(1<<PC5);
-				DDRC |= (1<<DDC5);
-				break;
-		}
-	} else if (state==KEY_ROW_STATE_INACTIVE) {
-		switch (row) {
-			case 0:
-				DDRA &= ~(1<<DDA5);
-				PORTA |= (1<<PA5);			
-				break;
-			case 1:
-				DDRA &= ~(1<<DDA6);
-				PORTA |= (1<<PA6);
-				break;
-			case 2:
-				DDRC &= ~(1<<DDC4);
-				PORTC |= (1<<PC4);
-				break;
-			case 3:
-				DDRC &= ~(1<<DDC5);
-				PORTC |= (1<<PC5);
-				break;
-		}
-	}	
+
+//rows are on PORTA and PORTC, active rows are driven low, inactive rows are pulled up
+#define KEY_ROWS_A ((1<<PA5) | (1<<PA6))
+#define KEY_ROWS_C ((1<<PC4) | (1<<PC5))
+static const uint8_t keyRowA[KEY_ROW_COUNT] = {(1<<PA5), (1<<PA6), 0, 0};
+static const uint8_t keyRowC[KEY_ROW_COUNT] = {0, 0, (1<<PC4), (1<<PC5)};
+
+//drive the rows given by the masks low, release all others
+//a row is never driven high: release with DDR then pull-up, activate with PORT low then DDR
+void setKeyRows(uint8_t maskA, uint8_t maskC) {
+	DDRA &= ~(KEY_ROWS_A & ~maskA);
+	DDRC &= ~(KEY_ROWS_C & ~maskC);
+	PORTA |= KEY_ROWS_A & ~maskA;
+	PORTC |= KEY_ROWS_C & ~maskC;
+	PORTA &= ~maskA;
+	PORTC &= ~maskC;
+	DDRA |= maskA;
+	DDRC |= maskC;
+	//wait for the input synchronizer
+	__asm__ __volatile__ ("nop");
 }
 
 void initKeyPad(void) {
@@ -192,10 +171,8 @@ void initKeyPad(void) {
 	PORTG |= (1<<PG2);
 	DDRC &= ~(1<<DDC7);
 	PORTC |= (1<<PC7);
-	setKeyRow(0,KEY_ROW_STATE_INACTIVE);
-	setKeyRow(1,KEY_ROW_STATE_INACTIVE);
-	setKeyRow(2,KEY_ROW_STATE_INACTIVE);
-	setKeyRow(3,KEY_ROW_STATE_INACTIVE);
+	//idle: all rows low, any key pulls its column low
+	setKeyRows(KEY_ROWS_A,KEY_ROWS_C);
 	//init backlight (off)
 	DDRC |= (1<<DDC2) | (1<<DDC3);
 	PORTC |= (1<<PC2) | (1<<PC3);
@@ -206,91 +183,67 @@ void initKeyPad(void) {
 }
 	
 uint8_t readKeyColumns(void) {
-	uint8_t col1,col2,col3;	
-	col1 = (~(PINA>>PINA7))&0x1; //col1
-	col2 = (~(PING>>PING2))&0x1; //col2
-	col3 = (~(PINC>>PINC7))&0x1; //col3		
-	return col1 | (col2<<1) | (col3<<2);
-}
-
-uint8_t getKeyRow(uint8_t row) {
-	switch (row) {
-		case 0:
-			return (PINA>>PINA5)&0x1;
-			break;
-		case 1:
-			return (PINA>>PINA6)&0x1;
-			break;
-		case 2:
-			return (PINC>>PINC4)&0x1;
-			break;
-		case 3:
-			return (PINC>>PINC5)&0x1;
-			break;
-	}	
-	return 0;
+	uint8_t pina,ping,pinc;
+	pina = ~PINA;
+	ping = ~PING;
+	pinc = ~PINC;
+	return ((pina>>PINA7)&0x1) | (((ping>>PING2)&0x1)<<1) | (((pinc>>PINC7)&0x1)<<2);
 }
 
 uint8_t checkKeyRow(uint8_t row) {
-	switch (row) {
-		case 0:
-			setKeyRow(1,KEY_ROW_STATE_INACTIVE);
-			setKeyRow(2,KEY_ROW_STATE_INACTIVE);
-			setKeyRow(3,KEY_ROW_STATE_INACTIVE);
-			setKeyRow(0,KEY_ROW_STATE_ACTIVE);				
-			//check if only one key			
-			if ((getKeyRow(1)&getKeyRow(2)&getKeyRow(3))==0) {
-				channelconfig_setBuzzer(500);
-				return 0;
-			}				
-			return readKeyColumns();
-			break;
-		case 1:
-			setKeyRow(0,KEY_ROW_STATE_INACTIVE);
-			setKeyRow(2,KEY_ROW_STATE_INACTIVE);
-			setKeyRow(3,KEY_ROW_STATE_INACTIVE);
-			setKeyRow(1,KEY_ROW_STATE_ACTIVE);
-			//check if only one key
-			if ((getKeyRow(0)&getKeyRow(2)&getKeyRow(3))==0) {
-				channelconfig_setBuzzer(500);
-				return 0;
-			}				
-			return readKeyColumns();
-			break;
-		case 2:
-			setKeyRow(0,KEY_ROW_STATE_INACTIVE);
-			setKeyRow(1,KEY_ROW_STATE_INACTIVE);
-			setKeyRow(3,KEY_ROW_STATE_INACTIVE);
-			setKeyRow(2,KEY_ROW_STATE_ACTIVE);
-			//check if only one key			
-			if ((getKeyRow(0)&getKeyRow(1)&getKeyRow(3))==0) {
-				channelconfig_setBuzzer(500);
-				return 0;
-			}				
-			return readKeyColumns();
-			break;
-		case 3:
-			setKeyRow(0,KEY_ROW_STATE_INACTIVE);
-			setKeyRow(1,KEY_ROW_STATE_INACTIVE);
-			setKeyRow(2,KEY_ROW_STATE_INACTIVE);
-			setKeyRow(3,KEY_ROW_STATE_ACTIVE);
-			//check if only one key
-			if ((getKeyRow(0)&getKeyRow(1)&getKeyRow(2))==0) {
-				channelconfig_setBuzzer(500);
-				return 0;
-			}				
-			return readKeyColumns();
-			break;					
-	}	
-	return 0;	
+	setKeyRows(keyRowA[row],keyRowC[row]);
+	//check if only one key, an inactive row pulled low means two keys share a column
+	if (((~PINA & KEY_ROWS_A & ~keyRowA[row]) | (~PINC & KEY_ROWS_C & ~keyRowC[row]))!=0) {
+		channelconfig_playBuzzer(BUZZER_PATTERN_ERROR,1);
+		return 0;
+	}
+	return readKeyColumns();
 }
 
 #define MAX_SEQUENCE 8
 volatile uint8_t sequence[MAX_SEQUENCE];
 volatile uint8_t seqIdx = 0;
 volatile uint8_t seqFlag = 0;
+volatile uint8_t keyTimer = 0;		//100ms, partial sequence is dropped when it runs out
+
+#define KEYPAD_KEY_TIMEOUT 50		//5s between two keys
+#define KEYPAD_MAX_FAILS 3			//wrong codes before lockout
+#define KEYPAD_LOCKOUT 30			//s, doubled with every further wrong code
+#define KEYPAD_LOCKOUT_MAX 900		//s
+
+//access codes, stored at the end of the EEPROM, erased slots (hash 0xFFFFFFFF) are unused
+#define EEPROM_KEYPAD_CODES	0xF00
+#define KEYPAD_CODE_SLOTS	8
+#define EEPROM_KEYPAD_FAILS	(EEPROM_KEYPAD_CODES+KEYPAD_CODE_SLOTS*sizeof(keycode_t))	//wrong codes in a row, 0xFF erased
+typedef struct
+{
+	uint32_t hash;			//FNV-1a over device id and key sequence
+	uint8_t address;		//action frame sent on a valid code
+	uint8_t channel;
+	uint8_t msgtype;
+	uint8_t reserved;
+} keycode_t;
+
+static uint8_t keyFails = 0;
+static uint16_t keyLockout = 0;		//s remaining
+
+//lockout doubles with every wrong code beyond KEYPAD_MAX_FAILS
+static void keypad_lock(void) {
+	uint8_t n = keyFails-KEYPAD_MAX_FAILS;
+	keyLockout = KEYPAD_LOCKOUT;
+	while (n-- && keyLockout<KEYPAD_LOCKOUT_MAX) keyLockout <<= 1;
+	if (keyLockout>KEYPAD_LOCKOUT_MAX) keyLockout = KEYPAD_LOCKOUT_MAX;
+}
+
+//failure count survives a power cycle, a locked keypad starts its lockout again
+static void keypad_restoreFails(void) {
+	keyFails = eeprom_read_byte((uint8_t *)EEPROM_KEYPAD_FAILS);
+	if (keyFails==0xFF) keyFails = 0;
+	if (keyFails>=KEYPAD_MAX_FAILS) keypad_lock();
+}
 
 void appendKey(uint8_t key) {
+	keyTimer = KEYPAD_KEY_TIMEOUT;
 	if (key==11) {
 		//# detected, scrap old sequence send #
 		sequence[0] = key;
@@ -311,14 +264,15 @@ void channelconfig_keyTask(void) {
 	uint8_t k;
 	uint16_t pushed,released;
 		
-	channelconfig_setBuzzer(0);
-	for (row=0;row<4;row++) {
-		state |= checkKeyRow(row)<<(row*3);
+	if (old_state==0 && readKeyColumns()==0) {
+		//idle, all rows are low and no column is pulled down
+		return;
+	}
+	for (row=0;row<KEY_ROW_COUNT;row++) {
+		state |= ((uint16_t)checkKeyRow(row))<<(row*3);
 	}	
-	setKeyRow(0,KEY_ROW_STATE_INACTIVE);
-	setKeyRow(1,KEY_ROW_STATE_INACTIVE);
-	setKeyRow(2,KEY_ROW_STATE_INACTIVE);
-	setKeyRow(3,KEY_ROW_STATE_INACTIVE);
+	//back to idle drive, scanning continues while keys are pressed
+	setKeyRows(KEY_ROWS_A,KEY_ROWS_C);
 	
 	if (state!=old_state) {
 		//key event occured
@@ -337,6 +291,102 @@ void channelconfig_keyTask(void) {
 	}
 	old_state = state;	
 }
+
+static uint32_t keypad_hash(const uint8_t *keys, uint8_t length) {
+	uint32_t hash = 2166136261UL;
+	uint8_t i;
+	hash = (hash ^ homecan_getDeviceID()) * 16777619UL;
+	for (i=0;i<length;i++) {
+		hash = (hash ^ keys[i]) * 16777619UL;
+	}
+	return hash;
+}
+
+void channelconfig_setKeyCode(uint8_t slot, uint32_t hash, uint8_t address, uint8_t channel, uint8_t msgtype) {
+	keycode_t code;
+	if (slot>=KEYPAD_CODE_SLOTS) return;
+	code.hash = hash;
+	code.address = address;
+	code.channel = channel;
+	code.msgtype = msgtype;
+	code.reserved = 0xFF;
+	eeprom_update_block(&code,(uint8_t *)(EEPROM_KEYPAD_CODES+slot*sizeof(keycode_t)),sizeof(keycode_t));
+}
+
+//returns the matching slot, KEYPAD_CODE_SLOTS if none matches, 0xFF if no code is stored at all
+static uint8_t keypad_findCode(const uint8_t *keys, uint8_t length, keycode_t *code) {
+	uint32_t hash = keypad_hash(keys,length);
+	uint8_t slot,used = 0;
+	for (slot=0;slot<KEYPAD_CODE_SLOTS;slot++) {
+		eeprom_read_block(code,(uint8_t *)(EEPROM_KEYPAD_CODES+slot*sizeof(keycode_t)),sizeof(keycode_t));
+		if (code->hash==0xFFFFFFFF) continue;
+		used = 1;
+		if (code->hash==hash) return slot;
+	}
+	return used?KEYPAD_CODE_SLOTS:0xFF;
+}
+
+static void keypad_audit(uint8_t channel, uint8_t result, uint8_t slot) {
+	homecan_t msg;
+	msg.header.priority = HOMECAN_HEADER_PRIO_DEFAULT;
+	msg.header.mode = HOMECAN_HEADER_MODE_SRC;
+	msg.msgtype = HOMECAN_MSGTYPE_KEYPAD_ACCESS;
+	msg.address = homecan_getDeviceID();
+	msg.channel = channel;
+	msg.length = 2;
+	msg.data[0] = result;
+	msg.data[1] = slot;
+	while (!homecan_transmit(&msg)) {
+		_delay_ms(1);
+	}
+}
+
+//verify a completed sequence, returns false if it has to be forwarded as KEY_SEQUENCE
+static bool keypad_verify(uint8_t channel, const uint8_t *keys, uint8_t length) {
+	homecan_t msg;
+	keycode_t code;
+	uint8_t slot;
+	if (length==1 && keys[0]==11) {
+		//# is a function key, not a code
+		return false;
+	}
+	slot = keypad_findCode(keys,length,&code);
+	if (slot==0xFF) {
+		//no codes stored, server verifies
+		return false;
+	}
+	if (keyLockout>0) {
+		channelconfig_playBuzzer(BUZZER_PATTERN_ERROR,3);
+		keypad_audit(channel,HOMECAN_KEYPAD_LOCKED,0xFF);
+		return true;
+	}
+	if (slot==KEYPAD_CODE_SLOTS) {
+		channelconfig_playBuzzer(BUZZER_PATTERN_ERROR,1);
+		if (keyFails<0xFE) keyFails++;
+		eeprom_update_byte((uint8_t *)EEPROM_KEYPAD_FAILS,keyFails);
+		if (keyFails>=KEYPAD_MAX_FAILS) {
+			keypad_lock();
+			debuglog(LOG_KEYPAD_LOCKED,channel,keyLockout);
+		}
+		keypad_audit(channel,HOMECAN_KEYPAD_DENIED,0xFF);
+		return true;
+	}
+	keyFails = 0;
+	eeprom_update_byte((uint8_t *)EEPROM_KEYPAD_FAILS,keyFails);
+	channelconfig_playBuzzer(BUZZER_PATTERN_CONFIRM,1);
+	msg.header.priority = HOMECAN_HEADER_PRIO_DEFAULT;
+	msg.header.mode = HOMECAN_HEADER_MODE_DST;
+	msg.msgtype = code.msgtype;
+	msg.address = code.address;
+	msg.channel = code.channel;
+	msg.length = 1;
+	msg.data[0] = 1;
+	while (!homecan_transmit(&msg)) {
+		_delay_ms(1);
+	}
+	keypad_audit(channel,HOMECAN_KEYPAD_GRANTED,slot);
+	return true;
+}
 #endif //CONFIG_KEYPAD
 
 void channelconfig_init_device(void) {
@@ -354,32 +404,50 @@ void channelconfig_10msUserISR() {}
 void channelconfig_100msUserTask() {
 #ifdef CONFIG_KEYPAD
 	uint8_t tmp_sreg;  // temporaerer Speicher fuer das Statusregister
+	uint8_t flag = 0;
 	homecan_t msg;
 	tmp_sreg = SREG;   // Statusregister (also auch das I-Flag darin) sichern
 	cli();             // Interrupts global deaktivieren
 	if (seqFlag) {
-		msg.address = homecan_getDeviceID();
-		msg.msgtype = HOMECAN_MSGTYPE_KEY_SEQUENCE;
-		msg.header.mode = HOMECAN_HEADER_MODE_SRC;
-		msg.header.priority = HOMECAN_HEADER_PRIO_DEFAULT;
-		msg.channel = channelconfig_getChannel(SENSORCAN_KEYPAD_PORT);
 		msg.length = seqIdx;
 		memcpy(msg.data,(const void*)&sequence[0],msg.length);
-		if (msg.channel!=0) {
-			homecan_transmit(&msg);
-		}
+		flag = 1;
 		seqFlag = 0;
 		seqIdx = 0;
+	} else if (keyTimer>0) {
+		if (--keyTimer==0) {
+			//too slow, drop partial sequence
+			seqIdx = 0;
+		}
 	}
 	SREG = tmp_sreg;     // Status-Register wieder herstellen
+	if (flag) {
+		msg.channel = channelconfig_getChannel(SENSORCAN_KEYPAD_PORT);
+		if (msg.channel!=0 && !keypad_verify(msg.channel,msg.data,msg.length)) {
+			msg.address = homecan_getDeviceID();
+			msg.msgtype = HOMECAN_MSGTYPE_KEY_SEQUENCE;
+			msg.header.mode = HOMECAN_HEADER_MODE_SRC;
+			msg.header.priority = HOMECAN_HEADER_PRIO_DEFAULT;
+			homecan_transmit(&msg);
+		}
+	}
 #endif
 }
 
-void channelconfig_1sUserTask() {}
+void channelconfig_1sUserTask() {
+#ifdef CONFIG_KEYPAD
+	if (keyLockout>0) {
+		keyLockout--;
+	}
+#endif
+}
 
 int main(void)
 {	
 	channelconfig_init();
+#ifdef CONFIG_KEYPAD
+	keypad_restoreFails();
+#endif
 
 	sei();
 